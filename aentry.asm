@@ -4,7 +4,7 @@ global _start
 global AppModInit
 
 extern AppMain
-extern MemModInit
+extern AppHeapModInit
 
 [section .text]
 [bits 32]
@@ -15,12 +15,7 @@ AppModInit: ; 0xF000
     
     mov dword [AppMainEntry], AppMain
     
-    push HeapSize
-    push AppHeapBase
-    
-    call MemModInit
-    
-    add esp, 8
+    call AppHeapModInit
     
     leave
     
@@ -0,0 +1,394 @@
+
+#include "ahci.h"
+#include "kernel.h"
+#include "pci.h"
+#include "page.h"
+#include "utility.h"
+
+#define AHCI_PCI_CLASS     0x01060100  //大容量存储控制器, SATA, AHCI 1.0
+#define AHCI_BAR5          0x24
+
+#define HBA_CAP            0x00
+#define HBA_GHC            0x04
+#define HBA_PI             0x0C
+#define HBA_PORT(i)        (0x100 + (i) * 0x80)
+
+#define CAP_SNCQ           (1 << 30)
+#define GHC_AE             (1 << 31)
+
+#define PX_CLB             0x00
+#define PX_CLBU            0x04
+#define PX_FB              0x08
+#define PX_FBU             0x0C
+#define PX_IS              0x10
+#define PX_IE              0x14
+#define PX_CMD             0x18
+#define PX_TFD             0x20
+#define PX_SIG             0x24
+#define PX_SSTS            0x28
+#define PX_SERR            0x30
+#define PX_SACT            0x34
+#define PX_CI              0x38
+
+#define PX_CMD_ST          (1 << 0)
+#define PX_CMD_FRE         (1 << 4)
+#define PX_CMD_FR          (1 << 14)
+#define PX_CMD_CR          (1 << 15)
+#define PX_IS_TFES         (1 << 30)
+#define PX_TFD_ERR         0x01
+#define PX_TFD_BUSY        0x88        //BSY | DRQ
+#define SIG_ATA            0x00000101
+
+#define FIS_H2D            0x27
+#define ATA_IDENTIFY       0xEC
+#define ATA_READ_DMA_EXT   0x25
+#define ATA_WRITE_DMA_EXT  0x35
+#define ATA_READ_FPDMA     0x60        //NCQ
+#define ATA_WRITE_FPDMA    0x61
+
+#define AC_MAX_PRDS        16                          //一条命令最多包含的请求数
+#define AC_MAX_SECTORS     (0x400000 / SECT_SIZE)      //一个PRD最多4MB, 保证每个请求只占一个PRD
+#define AC_TBL_SIZE        (0x80 + AC_MAX_PRDS * 16)   //命令FIS区0x80字节 + PRD表
+#define AC_MEM_SIZE        (0x400 + 0x100 + HD_MAX_SLOTS * AC_TBL_SIZE)
+#define AC_WAIT_LIMIT      0x40000000
+
+//命令列表中的命令头, 每个32字节
+typedef struct
+{
+    ushort flags;           //0~4位命令FIS长度(双字), 6位为写
+    ushort prdtl;           //PRD表项数
+    volatile uint prdbc;    //已传输字节数
+    uint ctba;              //命令表物理地址, 128字节对齐
+    uint ctbau;
+    uint reserved[4];
+} ACCmdHeader;
+
+typedef struct
+{
+    uint dba;               //数据缓冲区物理地址
+    uint dbau;
+    uint reserved;
+    uint dbc;               //0~21位为字节数减1
+} ACPrd;
+
+static byte* gACBase = NULL;        //HBA寄存器(ABAR)
+static uint gACPort = 0;
+static uint gACNCQ = 0;             //控制器和硬盘都支持NCQ
+static uint gACSectors = -1;
+static uint gACPending = 0;         //已填写但尚未提交给HBA的槽位
+static uint gACIssued = 0;          //已提交给HBA的槽位
+static ACCmdHeader* gACList = NULL;
+static byte* gACTables = NULL;
+static HDCommand* gACCmd[HD_MAX_SLOTS] = {0};
+
+static volatile uint* Reg(uint off)
+{
+    return (volatile uint*)AddrOff(gACBase, off);
+}
+
+static volatile uint* PortReg(uint off)
+{
+    return Reg(HBA_PORT(gACPort) + off);
+}
+
+static uint WaitClear(volatile uint* reg, uint mask)
+{
+    uint i = 0;
+    
+    while( (*reg & mask) && (i < AC_WAIT_LIMIT) )
+    {
+        i++;
+    }
+    
+    return !(*reg & mask);
+}
+
+static uint ACSectors()
+{
+    return gACSectors;
+}
+
+static uint ACMaxSectors()
+{
+    return AC_MAX_SECTORS;
+}
+
+//填写slot号命令头, 命令FIS和PRD表; NCQ命令的扇区数放在features, 槽位号放在count的3~7位
+static void Prepare(uint slot, uint command, uint si, uint cnt, uint write)
+{
+    ACCmdHeader* hdr = AddrOff(gACList, slot);
+    byte* fis = AddrOff(gACTables, slot * AC_TBL_SIZE);
+    uint ncq = (command == ATA_READ_FPDMA) || (command == ATA_WRITE_FPDMA);
+    
+    MemSet(fis, 0x80, 0);
+    
+    fis[0] = FIS_H2D;
+    fis[1] = 0x80;                  //命令寄存器
+    fis[2] = command;
+    fis[4] = si & 0xFF;
+    fis[5] = (si >> 8) & 0xFF;
+    fis[6] = (si >> 16) & 0xFF;
+    fis[7] = 0x40;                  //LBA模式
+    fis[8] = (si >> 24) & 0xFF;
+    
+    if( ncq )
+    {
+        fis[3] = cnt & 0xFF;
+        fis[11] = (cnt >> 8) & 0xFF;
+        fis[12] = slot << 3;
+    }
+    else
+    {
+        fis[12] = cnt & 0xFF;
+        fis[13] = (cnt >> 8) & 0xFF;
+    }
+    
+    hdr->flags = 5 | (write ? 0x40 : 0);
+    hdr->prdtl = 0;
+    hdr->prdbc = 0;
+    hdr->ctba = (uint)fis;
+    hdr->ctbau = 0;
+}
+
+static void AddPrd(uint slot, byte* buf, uint len)
+{
+    ACCmdHeader* hdr = AddrOff(gACList, slot);
+    ACPrd* prd = AddrOff((ACPrd*)AddrOff(gACTables, slot * AC_TBL_SIZE + 0x80), hdr->prdtl);
+    
+    prd->dba = (uint)buf;           //线性地址与物理地址一一对应
+    prd->dbau = 0;
+    prd->reserved = 0;
+    prd->dbc = len - 1;
+    
+    hdr->prdtl++;
+}
+
+//命令填写后暂不提交, 在ACPoll中一次写入SACT和CI, 一批命令只需要一次MMIO写
+static void ACIssue(HDCommand* cmd)
+{
+    uint command = cmd->write ? (gACNCQ ? ATA_WRITE_FPDMA : ATA_WRITE_DMA_EXT) : (gACNCQ ? ATA_READ_FPDMA : ATA_READ_DMA_EXT);
+    ListNode* pos = NULL;
+    
+    Prepare(cmd->tag, command, cmd->si, cmd->cnt, cmd->write);
+    
+    List_ForEach(&cmd->reqs, pos)
+    {
+        HDRequest* req = (HDRequest*)pos;
+        
+        AddPrd(cmd->tag, req->buf, req->cnt * SECT_SIZE);
+    }
+    
+    gACCmd[cmd->tag] = cmd;
+    gACPending |= 1 << cmd->tag;
+}
+
+static void Submit()
+{
+    if( gACPending )
+    {
+        if( gACNCQ )
+        {
+            *PortReg(PX_SACT) = gACPending;
+        }
+        
+        *PortReg(PX_CI) = gACPending;
+        
+        gACIssued |= gACPending;
+        gACPending = 0;
+    }
+}
+
+static uint Active()
+{
+    return gACNCQ ? (*PortReg(PX_SACT) | *PortReg(PX_CI)) : *PortReg(PX_CI);
+}
+
+//停止命令引擎后重新启动, 用于初始化和出错恢复
+static uint RestartPort()
+{
+    uint ret = 0;
+    
+    *PortReg(PX_CMD) &= ~(PX_CMD_ST | PX_CMD_FRE);
+    
+    if( WaitClear(PortReg(PX_CMD), PX_CMD_CR | PX_CMD_FR) )
+    {
+        *PortReg(PX_SERR) = 0xFFFFFFFF;
+        *PortReg(PX_IS) = 0xFFFFFFFF;
+        *PortReg(PX_CMD) |= PX_CMD_FRE;
+        
+        if( ret = WaitClear(PortReg(PX_TFD), PX_TFD_BUSY) )
+        {
+            *PortReg(PX_CMD) |= PX_CMD_ST;
+        }
+    }
+    
+    return ret;
+}
+
+static void Complete(uint slot, uint ok)
+{
+    HDCommand* cmd = gACCmd[slot];
+    
+    gACIssued &= ~(1 << slot);
+    
+    if( cmd )
+    {
+        gACCmd[slot] = NULL;
+        
+        HDRawComplete(cmd, ok);
+    }
+}
+
+//内核态关中断运行, 不使用MSI或INTx, 轮询SACT/CI判断命令完成
+static void ACPoll()
+{
+    uint done = 0;
+    uint i = 0;
+    
+    Submit();
+    
+    while( !(done = gACIssued & ~Active()) && !(*PortReg(PX_IS) & PX_IS_TFES) && (i < AC_WAIT_LIMIT) )
+    {
+        i++;
+    }
+    
+    if( done )
+    {
+        for(i=0; i<HD_MAX_SLOTS; i++)
+        {
+            if( done & (1 << i) )
+            {
+                Complete(i, 1);
+            }
+        }
+    }
+    else
+    {   //出错或超时: 放弃全部已提交的命令并重新启动端口
+        for(i=0; i<HD_MAX_SLOTS; i++)
+        {
+            if( gACIssued & (1 << i) )
+            {
+                Complete(i, 0);
+            }
+        }
+        
+        RestartPort();
+    }
+}
+
+static HDDevice gACDevice = { "ahci", 1, AC_MAX_PRDS, ACSectors, ACMaxSectors, ACIssue, ACPoll };
+
+//同步执行一条非NCQ命令, 只在初始化时使用
+static uint Execute(uint command, byte* buf, uint len)
+{
+    uint ret = 0;
+    
+    Prepare(0, command, 0, 0, 0);
+    AddPrd(0, buf, len);
+    
+    *PortReg(PX_CI) = 1;
+    
+    ret = WaitClear(PortReg(PX_CI), 1) && !(*PortReg(PX_IS) & PX_IS_TFES) && !(*PortReg(PX_TFD) & PX_TFD_ERR);
+    
+    return ret;
+}
+
+static uint Identify(uint ncs)
+{
+    uint ret = 0;
+    ushort* data = PageAlloc();
+    
+    if( data && (ret = Execute(ATA_IDENTIFY, (byte*)data, SECT_SIZE)) )
+    {
+        gACSectors = (data[61] << 16) | data[60];
+        
+        if( data[83] & 0x400 )  //LBA48
+        {
+            uint sectors = (data[101] << 16) | data[100];
+            
+            gACSectors = (data[102] || data[103]) ? HD_MAX_SCT_NUM : Min(sectors, HD_MAX_SCT_NUM);
+        }
+        
+        //第76字第8位表示支持NCQ, 第75字0~4位为队列深度减1
+        gACNCQ = (*Reg(HBA_CAP) & CAP_SNCQ) && (data[76] & 0x100);
+        gACDevice.slots = gACNCQ ? Min(ncs, (data[75] & 0x1F) + 1) : 1;
+    }
+    
+    PageFree(data);
+    
+    return ret;
+}
+
+static uint FindPort()
+{
+    uint ret = 0;
+    uint pi = *Reg(HBA_PI);
+    uint i = 0;
+    
+    for(i=0; !ret && (i<32); i++)
+    {
+        gACPort = i;
+        
+        ret = (pi & (1 << i)) && ((*PortReg(PX_SSTS) & 0x0F) == 3) && (*PortReg(PX_SIG) == SIG_ATA);
+    }
+    
+    return ret;
+}
+
+//寄存器页关闭缓存
+static void MapRegisters(uint base)
+{
+    uint addr = 0;
+    
+    for(addr=base; addr<(base + HBA_PORT(32)); addr+=PAGE_SIZE)
+    {
+        *GetPageEntry(addr) |= PG_PCD | PG_PWT;
+        FlushPage(addr);
+    }
+}
+
+//使用第一个连接了SATA硬盘的端口
+const HDDevice* AHCIModInit()
+{
+    const HDDevice* ret = NULL;
+    uint dev = PciFind(PCI_CLASS, 0xFFFFFF00, AHCI_PCI_CLASS, 0);
+    byte* mem = NULL;
+    
+    if( !gACBase && (dev != PCI_NONE) )
+    {
+        gACBase = (byte*)(PciRead(dev, AHCI_BAR5) & 0xFFFFFFF0);
+        
+        PciEnable(dev, PCI_CMD_MEM | PCI_CMD_MASTER);
+        MapRegisters((uint)gACBase);
+        
+        *Reg(HBA_GHC) |= GHC_AE;
+        
+        if( FindPort() && (mem = PageAllocN((AC_MEM_SIZE + PAGE_SIZE - 1) / PAGE_SIZE)) )
+        {
+            uint ncs = ((*Reg(HBA_CAP) >> 8) & 0x1F) + 1;
+            
+            MemSet(mem, AC_MEM_SIZE, 0);
+            
+            gACList = (ACCmdHeader*)mem;            //1KB对齐
+            gACTables = AddrOff(mem, 0x500);        //128字节对齐
+            
+            *PortReg(PX_CMD) &= ~(PX_CMD_ST | PX_CMD_FRE);
+            
+            if( WaitClear(PortReg(PX_CMD), PX_CMD_CR | PX_CMD_FR) )
+            {
+                *PortReg(PX_CLB) = (uint)gACList;
+                *PortReg(PX_CLBU) = 0;
+                *PortReg(PX_FB) = (uint)AddrOff(mem, 0x400);   //256字节对齐
+                *PortReg(PX_FBU) = 0;
+                *PortReg(PX_IE) = 0;
+                
+                if( RestartPort() && Identify(ncs) )
+                {
+                    ret = &gACDevice;
+                }
+            }
+        }
+    }
+    
+    return ret;
+}
@@ -0,0 +1,9 @@
+
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "hdraw.h"
+
+const HDDevice* AHCIModInit();
+
+#endif
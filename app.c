@@ -1,9 +1,57 @@
 
 #include "shell.h"
 #include "syscall.h"
+#include "memory.h"
 
-void AppMain()
+#define APP_TASK_SLOTS    17        //与内核的任务槽数(MAX_TASK_BUFF_NUM)一致
+
+static MemCache gAppCache[APP_TASK_SLOTS] = {0};
+static volatile uint gAppHeapLock = 0;
+
+//单处理器上xchg不会被中断打断; 锁被占用时让出时间片, 否则高优先级任务自旋时持有锁的低优先级任务得不到执行
+static uint AppHeapTryLock()
+{
+    uint busy = 1;
+    
+    asm volatile("xchgl %0, %1" : "+r"(busy), "+m"(gAppHeapLock) : : "memory");
+    
+    return !busy;
+}
+
+static void AppHeapLock()
+{
+    while( !AppHeapTryLock() )
+    {
+        Yield();
+    }
+}
+
+static void AppHeapUnlock()
 {
-    RegApp("Shell", Shell, 255);
+    asm volatile("" : : : "memory");
+    
+    gAppHeapLock = 0;
 }
 
+static void* AppHeapGrow(uint* size)
+{
+    *size = (*size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    return Sbrk(*size);
+}
+
+//AppModInit调用: 应用堆从AppHeapInit字节开始, 用完时通过Sbrk向内核申请映射新页
+//各任务的小对象分配走自己的缓存, 只有缓存为空或过满以及大对象分配才加锁
+void AppHeapModInit()
+{
+    MemModInit((byte*)AppHeapBase, AppHeapInit);
+    
+    MemSetGrow(AppHeapGrow, NULL);
+    MemSetLock(AppHeapLock, AppHeapUnlock);
+    MemSetCache(gAppCache, APP_TASK_SLOTS, (uint*)CurrentTaskSlot);
+}
+
+void AppMain()
+{
+    RegApp("Shell", Shell, 128);    //高于批处理任务(255), 按键唤醒后立即执行
+}
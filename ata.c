@@ -0,0 +1,265 @@
+
+#include "ata.h"
+#include "memory.h"
+#include "utility.h"
+
+#define ATA_IDENTIFY    0xEC
+#define ATA_READ        0x20
+#define ATA_WRITE       0x30
+#define ATA_READ_EXT    0x24
+#define ATA_WRITE_EXT   0x34
+
+//命令块寄存器相对于通道基址的偏移
+#define REG_DATA      0
+#define REG_FEATURES  1
+#define REG_ERROR     1
+#define REG_NSECTOR   2
+#define REG_LBA_LOW   3
+#define REG_LBA_MID   4
+#define REG_LBA_HIGH  5
+#define REG_DEVICE    6
+#define REG_STATUS    7
+#define REG_COMMAND   7
+
+#define HD_MAX_SECTORS  255     //LBA28一条命令最多传输的扇区数
+#define HD_MAX_SECTORS48 0xFFFF //LBA48一条命令最多传输的扇区数
+#define HD_LBA28_LIMIT  0x10000000
+
+extern byte ReadPort(ushort port);
+extern void WritePort(ushort port, byte value);
+extern void ReadPortW(ushort port, ushort* buf, uint n);
+extern void WritePortW(ushort port, ushort* buf, uint n);
+
+typedef struct
+{
+    ushort nsector;     //扇区数, LBA48时为16位
+    byte lbaLow;        //LBA24位
+    byte lbaMid;
+    byte lbaHigh;
+    byte lbaLow2;       //LBA48的24~47位
+    byte lbaMid2;
+    byte lbaHigh2;
+    byte device;        //
+    byte command;
+    byte lba48;         //是否使用LBA48命令
+} HDRegValue;
+
+static uint ATASectors();
+static uint ATADevMaxSectors();
+static void ATAIssue(HDCommand* cmd);
+
+//单盘设备使用主通道主盘
+static const HDDevice gATADevice = { "ata", 1, 0xFFFF, ATASectors, ATADevMaxSectors, ATAIssue, NULL };
+
+static ATADrive gATADrive[ATA_DRIVE_NUM] =
+{
+    { 0x1F0, 0x3F6, 0xE0, -1, 0 },
+    { 0x1F0, 0x3F6, 0xF0, -1, 0 },
+    { 0x170, 0x376, 0xE0, -1, 0 },
+    { 0x170, 0x376, 0xF0, -1, 0 },
+};
+
+static uint IsBusy(ATADrive* drv)
+{
+    uint ret = 0;
+    uint i = 0;
+    
+    while( (i < 500) && (ret = (ReadPort(drv->base + REG_STATUS) & STATUS_BSY)) )
+    {
+        i++;
+    }
+    
+    return ret;
+}
+
+static uint IsDevReady(ATADrive* drv)
+{
+    return !(ReadPort(drv->base + REG_STATUS) & STATUS_DRDY);
+}
+
+static uint IsDataReady(ATADrive* drv)
+{
+    return ReadPort(drv->base + REG_STATUS) & STATUS_DRQ;
+}
+
+static uint MakeDevRegVal(ATADrive* drv, uint si, uint lba48)
+{
+    return lba48 ? drv->device : (drv->device | ((si >> 24) & 0x0F));
+}
+
+//起始扇区超出28位或扇区数超过255时使用LBA48的EXT命令
+static uint NeedLBA48(ATADrive* drv, uint si, uint cnt)
+{
+    return drv->lba48 && ((si >= HD_LBA28_LIMIT) || (cnt > (HD_LBA28_LIMIT - si)) || (cnt > HD_MAX_SECTORS));
+}
+
+uint ATAMaxSectors(ATADrive* drv)
+{
+    return drv->lba48 ? HD_MAX_SECTORS48 : HD_MAX_SECTORS;
+}
+
+static HDRegValue MakeRegVals(ATADrive* drv, uint si, uint cnt, uint action)
+{
+    HDRegValue ret = {0};
+    
+    ret.lba48 = NeedLBA48(drv, si, cnt);
+    ret.nsector = cnt;
+    ret.lbaLow = si & 0xFF;
+    ret.lbaMid = (si >> 8) & 0xFF;
+    ret.lbaHigh = (si >> 16) & 0xFF;
+    ret.lbaLow2 = (si >> 24) & 0xFF;
+    ret.device = MakeDevRegVal(drv, si, ret.lba48);
+    ret.command = action;
+    
+    if( ret.lba48 )
+    {
+        ret.command = (action == ATA_READ) ? ATA_READ_EXT : ((action == ATA_WRITE) ? ATA_WRITE_EXT : action);
+    }
+    
+    return ret;
+}
+
+static void WritePorts(ATADrive* drv, HDRegValue hdrv)
+{
+    WritePort(drv->base + REG_FEATURES, 0);                     //
+    
+    if( hdrv.lba48 )
+    {   //LBA48的寄存器为两级FIFO, 先写入高字节再写入低字节
+        WritePort(drv->base + REG_NSECTOR, (hdrv.nsector >> 8) & 0xFF);
+        WritePort(drv->base + REG_LBA_LOW, hdrv.lbaLow2);
+        WritePort(drv->base + REG_LBA_MID, hdrv.lbaMid2);
+        WritePort(drv->base + REG_LBA_HIGH, hdrv.lbaHigh2);
+    }
+    
+    WritePort(drv->base + REG_NSECTOR, hdrv.nsector & 0xFF);    //扇区数
+    WritePort(drv->base + REG_LBA_LOW, hdrv.lbaLow);            //LBA的地址
+    WritePort(drv->base + REG_LBA_MID, hdrv.lbaMid);
+    WritePort(drv->base + REG_LBA_HIGH, hdrv.lbaHigh);          
+    WritePort(drv->base + REG_DEVICE, hdrv.device);             //操作哪块硬盘
+    WritePort(drv->base + REG_COMMAND, hdrv.command);           //指定命令块寄存器值 读/写
+        
+    WritePort(drv->ctrl, 0);                                    //控制块命令字
+}
+
+static uint Identify(ATADrive* drv)
+{
+    uint ret = -1;
+    
+    if( IsDevReady(drv) )
+    {
+        HDRegValue hdrv = MakeRegVals(drv, 0, 1, ATA_IDENTIFY);//0xEC获取硬盘信息
+        byte* buf = Malloc(SECT_SIZE);
+        
+        WritePorts(drv, hdrv);
+        
+        if( !IsBusy(drv) && IsDataReady(drv) && buf )
+        {
+            ushort* data = (ushort*)buf;
+            
+            ReadPortW(drv->base + REG_DATA, data, SECT_SIZE >> 1);
+            
+            ret = (data[61] << 16) | (data[60]);
+            
+            //支持LBA48时第100~103字为64位扇区总数, 超出32位扇区号的部分无法使用
+            if( drv->lba48 = !!(data[83] & 0x400) )
+            {
+                uint sectors = (data[101] << 16) | data[100];
+                
+                ret = (data[102] || data[103]) ? HD_MAX_SCT_NUM : Max(ret, Min(sectors, HD_MAX_SCT_NUM));
+            }
+        }
+        
+        Free(buf);
+    }
+    
+    return ret;
+}
+
+void ATAModInit()
+{
+    uint i = 0;
+    
+    for(i=0; i<ATA_DRIVE_NUM; i++)
+    {
+        gATADrive[i].sectors = Identify(gATADrive + i);
+    }
+}
+
+//idx = 通道 * 2 + 从盘; 硬盘不存在时返回NULL
+ATADrive* ATAGetDrive(uint idx)
+{
+    return ((idx < ATA_DRIVE_NUM) && (gATADrive[idx].sectors != -1)) ? gATADrive + idx : NULL;
+}
+
+const HDDevice* ATAGetDevice()
+{
+    return &gATADevice;
+}
+
+//发出读写命令, 之后每个扇区在ATAStatus()为DRQ时用ATATransfer()传输
+uint ATACommand(ATADrive* drv, uint si, uint cnt, uint write)
+{
+    uint ret = 0;
+    
+    if( ret = !IsBusy(drv) )
+    {
+        WritePorts(drv, MakeRegVals(drv, si, cnt, write ? ATA_WRITE : ATA_READ));
+    }
+    
+    return ret;
+}
+
+//不等待, 直接读取状态寄存器
+byte ATAStatus(ATADrive* drv)
+{
+    return ReadPort(drv->base + REG_STATUS);
+}
+
+uint ATATransfer(ATADrive* drv, byte* buf, uint write)
+{
+    uint ret = 0;
+    
+    if( ret = (!IsBusy(drv) && IsDataReady(drv)) )
+    {
+        if( write )
+        {
+            WritePortW(drv->base + REG_DATA, (ushort*)buf, SECT_SIZE >> 1);
+        }
+        else
+        {
+            ReadPortW(drv->base + REG_DATA, (ushort*)buf, SECT_SIZE >> 1);
+        }
+    }
+    
+    return ret;
+}
+
+static uint ATASectors()
+{
+    return gATADrive[0].sectors;
+}
+
+static uint ATADevMaxSectors()
+{
+    return ATAMaxSectors(gATADrive);
+}
+
+//PIO方式一次只能执行一条命令, 在issue中完成全部传输
+static void ATAIssue(HDCommand* cmd)
+{
+    ListNode* pos = NULL;
+    uint ok = ATACommand(gATADrive, cmd->si, cmd->cnt, cmd->write);
+    
+    List_ForEach(&cmd->reqs, pos)
+    {
+        HDRequest* req = (HDRequest*)pos;
+        uint i = 0;
+        
+        for(i=0; ok && (i<req->cnt); i++)
+        {
+            ok = ATATransfer(gATADrive, AddrOff(req->buf, i * SECT_SIZE), cmd->write);
+        }
+    }
+    
+    HDRawComplete(cmd, ok);
+}
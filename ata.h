@@ -0,0 +1,35 @@
+
+#ifndef ATA_H
+#define ATA_H
+
+#include "hdraw.h"
+
+#define ATA_DRIVE_NUM   4           //主/从通道各有主盘和从盘
+
+#define	STATUS_BSY  0x80
+#define	STATUS_DRDY 0x40
+#define	STATUS_DFSE 0x20
+#define	STATUS_DSC  0x10
+#define	STATUS_DRQ  0x08
+#define	STATUS_CORR 0x04
+#define	STATUS_IDX  0x02
+#define	STATUS_ERR  0x01
+
+typedef struct
+{
+    ushort base;                    //命令块寄存器基址, 主通道0x1F0, 从通道0x170
+    ushort ctrl;                    //设备控制寄存器, 主通道0x3F6, 从通道0x376
+    byte device;                    //设备寄存器高4位, 主盘0xE0, 从盘0xF0
+    uint sectors;                   //扇区总数, -1表示硬盘不存在
+    uint lba48;                     //硬盘支持LBA48: IDENTIFY第83字第10位
+} ATADrive;
+
+void ATAModInit();
+ATADrive* ATAGetDrive(uint idx);
+const HDDevice* ATAGetDevice();
+uint ATAMaxSectors(ATADrive* drv);
+uint ATACommand(ATADrive* drv, uint si, uint cnt, uint write);
+byte ATAStatus(ATADrive* drv);
+uint ATATransfer(ATADrive* drv, byte* buf, uint write);
+
+#endif
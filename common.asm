@@ -3,6 +3,7 @@ HeapBase       equ    0x70000
 HeapSize       equ    0x20000
 KernelHeapBase equ    HeapBase
 AppHeapBase    equ    HeapBase - HeapSize
+AppHeapInit    equ    0x10000
 PageDirBase    equ    HeapBase + HeapSize
 PageTblBase    equ    PageDirBase + 0x1000
 
@@ -26,6 +27,7 @@ MemSize              equ       BaseOfSharedMemory + 24
 SendEOIEntry         equ       BaseOfSharedMemory + 28
 LoadTaskEntry        equ       BaseOfSharedMemory + 32
 AppMainEntry         equ       BaseOfSharedMemory + 36
+CurrentTaskSlot      equ       BaseOfSharedMemory + 40
 
 ; PIC-8259A Ports 
 MASTER_ICW1_PORT                        equ     0x20
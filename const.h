@@ -8,8 +8,26 @@
 #define HeapSize       0x20000
 #define KernelHeapBase HeapBase
 #define AppHeapBase    (HeapBase - HeapSize)
+#define AppHeapInit    0x10000
 #define PageDirBase    (HeapBase + HeapSize)
 #define PageTblBase    (PageDirBase + 0x1000)
+#define PageTblSize    0x400000
+#define FreePageBase   (PageTblBase + PageTblSize)
+#define TaskSpaceBase  0x40000000u
+#define TaskSpaceSize  0x40000000u
+
+#define PAGE_SIZE      0x1000
+#define FMapBase       0x20000
+#define FMapSize       0x20000
+
+#define PG_P           1
+#define PG_RWW         2
+#define PG_USU         4
+#define PG_PWT         8
+#define PG_PCD         0x10
+#define PG_PS          0x80
+#define PG_G           0x100
+#define PG_COW         0x200
 
 #define AppStackSize    512
 
@@ -18,6 +36,7 @@
 
 #define BaseOfSharedMemory 0xA000
 #define AppMainEntry       (BaseOfSharedMemory + 36)
+#define CurrentTaskSlot    (BaseOfSharedMemory + 40)
 
 #define    DA_DPL0            0x00
 #define    DA_DPL1            0x20
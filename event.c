@@ -1,10 +1,11 @@
 
 #include "event.h"
-#include "memory.h"
+#include "task.h"
 
+//事件总是由当前任务创建并用于等待, 使用任务自带的事件, 等待和唤醒都不经过内存分配
 Event* CreateEvent(uint type, uint id, uint param1, uint param2)
 {
-    Event* ret = Malloc(sizeof(Event));
+    Event* ret = CurrentTaskEvent();
     
     if( ret )
     {
@@ -19,5 +20,8 @@ Event* CreateEvent(uint type, uint id, uint param1, uint param2)
 
 void DestroyEvent(Event* event)
 {
-    Free(event);
+    if( event )
+    {
+        event->type = NoneEvent;
+    }
 }
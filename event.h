@@ -9,7 +9,8 @@ enum
     NoneEvent,
     MutexEvent,
     KeyEvent,
-    TaskEvent
+    TaskEvent,
+    FileEvent
 };
 
 typedef struct
@@ -0,0 +1,231 @@
+
+#include "fmap.h"
+#include "fs.h"
+#include "kernel.h"
+#include "task.h"
+#include "memory.h"
+#include "list.h"
+
+#define FMAP_PAGE_NUM    (FMapSize / PAGE_SIZE)
+#define FMAP_FREE        0
+#define FMAP_USED        1           //属于某个映射区域, 文件数据还未装入
+#define FMAP_LOADED      2           //文件数据已装入
+
+//文件映射区域, 映射窗口位于[FMapBase, FMapBase + FMapSize), 线性地址与物理地址一一对应
+//窗口在低4MB内, 页表为所有页目录共享, 所以任务切换时只让新任务自己的已装入页存在, 其他任务的映射对它不可见
+typedef struct
+{
+    ListNode head;
+    uint fd;            //被映射的文件描述符
+    uint task;          //建立映射的任务id
+    uint offset;        //映射起始位置在文件中的偏移(页对齐)
+    uint addr;          //映射区域在窗口中的起始地址
+    uint pages;         //映射区域的页数
+} FMapArea;
+
+static List gFMapList = {0};
+static byte gFMapUsed[FMAP_PAGE_NUM] = {0};
+static uint gFMapTask = 0;          //窗口页的存在位当前按哪个任务设置
+
+void FMapModInit()
+{
+    List_Init(&gFMapList);
+}
+
+static uint FindFreePages(uint pages)
+{
+    uint ret = -1;
+    uint cnt = 0;
+    uint i = 0;
+    
+    for(i=0; i<FMAP_PAGE_NUM; i++)
+    {
+        cnt = gFMapUsed[i] ? 0 : (cnt + 1);
+        
+        if( cnt == pages )
+        {
+            ret = i + 1 - pages;
+            break;
+        }
+    }
+    
+    return ret;
+}
+
+//建立映射时窗口页标记为不存在,首次访问时由缺页中断装入文件数据; 解除映射后清除装入的文件数据, 恢复为普通可读写页
+static void SetWindow(uint addr, uint pages, uint used)
+{
+    uint i = 0;
+    
+    for(i=0; i<pages; i++)
+    {
+        uint page = addr + i * PAGE_SIZE;
+        uint* pte = GetPageEntry(page);
+        byte* state = &gFMapUsed[(page - FMapBase) / PAGE_SIZE];
+        
+        *pte = used ? (*pte & ~PG_P) : (*pte | PG_P | PG_RWW | PG_USU);
+        
+        FlushPage(page);
+        
+        if( *state == FMAP_LOADED )
+        {
+            MemSet((byte*)page, PAGE_SIZE, 0);
+        }
+        
+        *state = used ? FMAP_USED : FMAP_FREE;
+    }
+}
+
+static FMapArea* FindArea(uint addr)
+{
+    FMapArea* ret = NULL;
+    ListNode* pos = NULL;
+    
+    List_ForEach(&gFMapList, pos)
+    {
+        FMapArea* area = (FMapArea*)pos;
+        
+        if( (area->addr <= addr) && (addr < (area->addr + area->pages * PAGE_SIZE)) )
+        {
+            ret = area;
+            break;
+        }
+    }
+    
+    return ret;
+}
+
+static void DelArea(FMapArea* area)
+{
+    SetWindow(area->addr, area->pages, 0);
+    
+    List_DelNode((ListNode*)area);
+    
+    Free(area);
+}
+
+//返回映射后offset对应的线性地址, 失败返回0
+uint FMap(uint fd, uint offset, uint len)
+{
+    uint ret = 0;
+    uint flen = FLength(fd);
+    
+    if( (flen != -1) && (offset < flen) && len )
+    {
+        uint begin = offset - offset % PAGE_SIZE;
+        uint pages = 0;
+        uint idx = 0;
+        FMapArea* area = NULL;
+        
+        len = Min(len, flen - offset);
+        pages = (offset - begin + len + PAGE_SIZE - 1) / PAGE_SIZE;
+        idx = FindFreePages(pages);
+        area = (idx != -1) ? Malloc(sizeof(FMapArea)) : NULL;
+        
+        if( area )
+        {
+            area->fd = fd;
+            area->task = CurrentTaskId();
+            area->offset = begin;
+            area->addr = FMapBase + idx * PAGE_SIZE;
+            area->pages = pages;
+            
+            SetWindow(area->addr, area->pages, 1);
+            
+            List_Add(&gFMapList, (ListNode*)area);
+            
+            ret = area->addr + (offset - begin);
+        }
+    }
+    
+    return ret;
+}
+
+uint FUnmap(uint addr)
+{
+    FMapArea* area = FindArea(addr);
+    uint ret = 0;
+    
+    if( ret = (area && (area->task == CurrentTaskId())) )
+    {
+        DelArea(area);
+    }
+    
+    return ret;
+}
+
+//文件关闭前解除此文件的全部映射
+void FUnmapFile(uint fd)
+{
+    ListNode* pos = gFMapList.next;
+    
+    while( !IsEqual(pos, &gFMapList) )
+    {
+        FMapArea* area = (FMapArea*)pos;
+        
+        pos = pos->next;
+        
+        if( area->fd == fd )
+        {
+            DelArea(area);
+        }
+    }
+}
+
+//缺页中断调用: 将文件数据直接读入映射页, 页面对任务只读; 返回0表示不是文件映射引起的缺页
+uint FMapFault(uint addr)
+{
+    FMapArea* area = FindArea(addr);
+    uint* pte = GetPageEntry(addr);
+    uint ret = 0;
+    
+    if( area && (area->task == CurrentTaskId()) && !(*pte & PG_P) )
+    {
+        uint page = addr - addr % PAGE_SIZE;
+        
+        *pte = (*pte | PG_P | PG_USU) & ~PG_RWW;
+        
+        FlushPage(page);
+        
+        if( ret = FReadAt(area->fd, area->offset + (page - area->addr), (byte*)page, PAGE_SIZE) )
+        {
+            gFMapUsed[(page - FMapBase) / PAGE_SIZE] = FMAP_LOADED;
+        }
+        else
+        {
+            *pte = *pte & ~PG_P;
+            
+            FlushPage(page);
+        }
+    }
+    
+    return ret;
+}
+
+//任务切换时调用: 只有task自己的映射区域中已装入的页存在, 其余映射页不存在, 访问时缺页
+void FMapSwitch(uint task)
+{
+    ListNode* pos = NULL;
+    uint i = 0;
+    
+    if( task != gFMapTask )
+    {
+        List_ForEach(&gFMapList, pos)
+        {
+            FMapArea* area = (FMapArea*)pos;
+            
+            for(i=0; i<area->pages; i++)
+            {
+                uint page = area->addr + i * PAGE_SIZE;
+                uint* pte = GetPageEntry(page);
+                uint show = (area->task == task) && (gFMapUsed[(page - FMapBase) / PAGE_SIZE] == FMAP_LOADED);
+                
+                *pte = show ? (*pte | PG_P) : (*pte & ~PG_P);
+                
+                FlushPage(page);
+            }
+        }
+        
+        gFMapTask = task;
+    }
+}
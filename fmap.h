@@ -0,0 +1,14 @@
+
+#ifndef FMAP_H
+#define FMAP_H
+
+#include "type.h"
+
+void FMapModInit();
+uint FMap(uint fd, uint offset, uint len);
+uint FUnmap(uint addr);
+void FUnmapFile(uint fd);
+uint FMapFault(uint addr);
+void FMapSwitch(uint task);
+
+#endif
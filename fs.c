@@ -1,58 +1,26 @@
 #include "hdraw.h"
 #include "fs.h"
+#include "fsdef.h"
 #include "utility.h"
 #include "list.h"
+#include "queue.h"
 
 #ifdef DTFSER
 #include <malloc.h>
 #define Malloc malloc
 #define Free free
+#define DmaBuf(buf) (buf)
+#define FDAlloc(owner) Malloc(FD_BYTES)
+#define FDFree(fd) Free(fd)
 #else
 #include "memory.h"
+#include "task.h"
+#include "fmap.h"
 #endif
 
-#define FS_MAGIC       "fengyunFS-v1.0"
-#define ROOT_MAGIC     "ROOT"
-#define HEADER_SCT_IDX 0
-#define ROOT_SCT_IDX   1
-#define FIXED_SCT_SIZE 2
-#define SCT_END_FLAG   ((uint)-1)
-#define FE_BYTES       sizeof(FileEntry)
 #define FD_BYTES       sizeof(FileDesc)
-#define FE_ITEM_CNT    (SECT_SIZE / FE_BYTES)
-#define MAP_ITEM_CNT   (SECT_SIZE / sizeof(uint))
-
-//存储于0号引导区
-typedef struct
-{
-    byte forJmp[4];         //预留给jmp指令使用,万一0号扇区需要存储引导程序呢
-    char magic[32];         //存储字符串标识现在是什么文件系统
-    uint sctNum;            //多少扇区可以使用
-    uint mapSize;           //扇区分配表的大小 
-    uint freeNum;           //空闲链表长度
-    uint freeBegin;         //空闲链表开始
-} FSHeader;
-
-//存储于1号根目录区
-typedef struct
-{
-    char magic[32];         //"ROOT"
-    uint sctBegin;          //根目录的开始扇区,本OS初始化时设置为1
-    uint sctNum;            //占用多少个扇区,本OS初始化设置为0非法值,表示还没有FileEntry
-    uint lastBytes;			//最后一个扇区用了多少字节
-} FSRoot;
-
-typedef struct
-{
-    char name[32];          //文件名
-    uint sctBegin;          //文件起始扇区
-    uint sctNum;            //多少个扇区
-    uint lastBytes;         //
-    uint type;              //是文件还是目录 存储的是用户数据还是文件相关的数据
-    uint inSctIdx;          //硬盘的哪一个扇区
-    uint inSctOff;			//扇区内偏移位置
-    uint reserved[2];		//预留
-} FileEntry;
+#define NAME_BYTES     sizeof(((FileEntry*)0)->name)
+#define FS_BATCH_CNT   8
 
 typedef struct
 {
@@ -61,6 +29,8 @@ typedef struct
     uint objIdx;            //文件读写位置-哪一个扇区
     uint offset;            //文件读写位置-扇区内偏移位置
     uint changed;           //标志文件已经改变，关闭文件时changed若为1则将cache写入到硬盘
+    uint owner;             //通过系统调用打开此文件的任务id,内核直接打开时为0
+    Queue wait;             //等待此文件被关闭的任务队列
     byte cache[SECT_SIZE];  //文件缓冲区-512字节大小
 } FileDesc;
 
@@ -72,6 +42,29 @@ typedef struct
     uint idxOff;            //扇区中偏移位置
 } MapPos;
 
+#ifndef DTFSER
+
+//通过系统调用打开的文件描述符从打开者的arena分配: 任务结束时FSTaskExit先关闭它们, 之后arena整体归还
+//内核直接打开的文件(owner为0)不属于任何任务, 从全局堆分配
+static void* FDAlloc(uint owner)
+{
+    return owner ? ArenaAlloc(CurrentTaskArena(), FD_BYTES) : Malloc(FD_BYTES);
+}
+
+static void FDFree(FileDesc* fd)
+{
+    if( fd->owner )
+    {
+        ArenaFree(fd);
+    }
+    else
+    {
+        Free(fd);
+    }
+}
+
+#endif
+
 static List gFDList = {0};  //全局已经打开的文件描述符链表
 
 void FSModInit()
@@ -543,9 +536,9 @@ uint FExisted(const char* fn)
     return ret;
 }
 
-static uint IsOpened(const char* name)
+static FileDesc* FindOpened(const char* name)
 {
-    uint ret = 0;
+    FileDesc* ret = NULL;
     ListNode* pos = NULL;
 
     List_ForEach(&gFDList, pos)
@@ -554,7 +547,7 @@ static uint IsOpened(const char* name)
 
         if( StrCmp(fd->fe.name, name, -1) )
         {
-            ret = 1;
+            ret = fd;
             break;
         }
     }
@@ -562,6 +555,11 @@ static uint IsOpened(const char* name)
     return ret;
 }
 
+static uint IsOpened(const char* name)
+{
+    return !!FindOpened(name);
+}
+
 static uint FreeFile(uint sctBegin)
 {
     uint slider = sctBegin;
@@ -692,7 +690,7 @@ static uint DeleteInRoot(const char* name)
     return ret;
 }
 
-uint FOpen(const char *fn)
+static FileDesc* OpenFile(const char* fn, uint owner)
 {
     FileDesc* ret = NULL;
     //文件名不为空且文件未被打开
@@ -700,7 +698,7 @@ uint FOpen(const char *fn)
     {
         FileEntry* fe = NULL;
         //分配文件描述符并且获取FileEntry
-        ret = (FileDesc*)Malloc(FD_BYTES);
+        ret = (FileDesc*)FDAlloc(owner);
         fe = ret ? FindInRoot(fn) : NULL;
 
         if( ret && fe )
@@ -709,14 +707,30 @@ uint FOpen(const char *fn)
             ret->objIdx = SCT_END_FLAG;
             ret->offset = SECT_SIZE;
             ret->changed = 0;
+            ret->owner = owner;
+
+            Queue_Init(&ret->wait);
 
             List_Add(&gFDList, (ListNode*)ret);
         }
+        else if( ret )
+        {
+            ret->owner = owner;
+
+            FDFree(ret);
+
+            ret = NULL;
+        }
 
         Free(fe);
     }
 
-    return (uint)ret;
+    return ret;
+}
+
+uint FOpen(const char *fn)
+{
+    return (uint)OpenFile(fn, 0);
 }
 
 static uint IsFDValid(FileDesc* fd)
@@ -776,17 +790,26 @@ static uint ToFlush(FileDesc* fd)
     return FlushCache(fd) && FlushFileEntry(&fd->fe);
 }
 
+//不论文件由内核直接打开还是通过系统调用打开, 关闭时都唤醒等待此文件的任务并解除它的全部映射
 void FClose(uint fd)
 {
     FileDesc* pf = (FileDesc*)fd;
     //文件描述符是否合法
     if( IsFDValid(pf) )
-    {   //写到硬盘上
+    {
+#ifndef DTFSER
+        Event evt = {FileEvent, (uint)&pf->wait, 0, 0};
+
+        EventSchedule(NOTIFY, &evt);
+
+        FUnmapFile(fd);
+#endif
+        //写到硬盘上
         ToFlush(pf);
         //链表删除
         List_DelNode((ListNode*)pf);
 
-        Free(pf);
+        FDFree(pf);
     }
 }
 //链表中的第idx个扇区数据读入缓冲区中
@@ -897,10 +920,12 @@ uint FSFormat()
 {
     FSHeader* header = (FSHeader*)Malloc(SECT_SIZE);        //引导区
     FSRoot* root = (FSRoot*)Malloc(SECT_SIZE);              //根目录区
-    uint* p = (uint*)Malloc(MAP_ITEM_CNT * sizeof(uint));   //操作扇区分配表的每一个分配单元
+    uint* p = (uint*)Malloc(FS_BATCH_CNT * SECT_SIZE);      //一次写入FS_BATCH_CNT个扇区分配表扇区
+    uint sctNum = HDRawSectors();
     uint ret = 0;
 
-    if( header && root && p )
+    //扇区号为32位, HDRawSectors()已将大于2TiB的硬盘截断; 返回-1说明硬盘不可用
+    if( header && root && p && (sctNum != SCT_END_FLAG) && (sctNum > FIXED_SCT_SIZE + 1) )
     {
         uint i = 0;
         uint j = 0;
@@ -908,7 +933,7 @@ uint FSFormat()
 
         //给引导区的内容赋值
         StrCpy(header->magic, FS_MAGIC, sizeof(header->magic)-1);
-        header->sctNum = HDRawSectors();
+        header->sctNum = sctNum;
         header->mapSize = (header->sctNum - FIXED_SCT_SIZE) / 129 + !!((header->sctNum - FIXED_SCT_SIZE) % 129);
         header->freeNum = header->sctNum - header->mapSize - FIXED_SCT_SIZE;
         header->freeBegin = FIXED_SCT_SIZE + header->mapSize;
@@ -923,32 +948,37 @@ uint FSFormat()
         //注意一定要写回硬盘
         ret = ret && HDRawWrite(ROOT_SCT_IDX, (byte*)root);
 
-        //针对于扇区分配表(2~n 的扇区)的每个分配单元赋值
-        for(i=0; ret && (i<header->mapSize) && (current<header->freeNum); i++)
-        {   
+        //针对于扇区分配表(2~n 的扇区)的每个分配单元赋值, 大容量硬盘的分配表很大, 所以连续的多个扇区用一条请求写入
+        for(i=0; ret && (i<header->mapSize) && (current<header->freeNum); i+=FS_BATCH_CNT)
+        {
+            HDRequest req = {0};
+            uint cnt = Min(header->mapSize - i, FS_BATCH_CNT);
+
             //每个扇区的128个的每个分配单元赋值
-            for(j=0; j<MAP_ITEM_CNT; j++)
+            for(j=0; (j<cnt * MAP_ITEM_CNT) && (current<header->freeNum); j++)
             {
                 uint* pInt = AddrOff(p, j);
 
-                if( current < header->freeNum )
-                {
-                    *pInt = current + 1;
-
-                    if( current == (header->freeNum - 1) )
-                    {
-                        *pInt = SCT_END_FLAG;
-                    }
+                *pInt = current + 1;
 
-                    current++;
-                }
-                else
+                if( current == (header->freeNum - 1) )
                 {
-                    break;
+                    *pInt = SCT_END_FLAG;
                 }
+
+                current++;
             }
+
             //写回硬盘
-            ret = ret && HDRawWrite(i + FIXED_SCT_SIZE, (byte*)p);
+            req.si = i + FIXED_SCT_SIZE;
+            req.cnt = cnt;
+            req.buf = (byte*)p;
+            req.write = 1;
+
+            HDRawSubmit(&req);
+            HDRawKick();
+
+            ret = req.result;
         }
     }
 
@@ -1051,6 +1081,77 @@ static uint CopyFromCache(FileDesc* fd, byte* buf, uint len)
     return ret;
 }
 
+#ifndef DTFSER
+
+//硬盘DMA使用物理地址: 低端恒等映射区域中的扇区缓冲区直接使用, 任务私有区域中的换成所在物理页的内核地址
+//私有区域中跨页的扇区在物理上不连续, 返回NULL, 由调用者经内核缓冲区中转
+static byte* DmaBuf(byte* buf)
+{
+    byte* ret = buf;
+    uint addr = (uint)buf;
+
+    if( addr >= TaskSpaceBase )
+    {
+        ret = ((addr % PAGE_SIZE) <= (PAGE_SIZE - SECT_SIZE)) ? TaskKernelAddr(addr) : NULL;
+    }
+
+    return ret;
+}
+
+#endif
+
+//读一个扇区到buf, buf不能直接用于DMA时先读入内核缓冲区再复制
+static uint ReadUserSector(uint sctIdx, byte* buf)
+{
+    uint ret = 0;
+    byte* dma = DmaBuf(buf);
+
+    if( dma )
+    {
+        ret = HDRawRead(sctIdx, dma);
+    }
+    else if( dma = Malloc(SECT_SIZE) )
+    {
+        if( ret = HDRawRead(sctIdx, dma) )
+        {
+            MemCpy(buf, dma, SECT_SIZE);
+        }
+
+        Free(dma);
+    }
+
+    return ret;
+}
+
+//缓冲区已读完且剩余数据不少于一个扇区时,整扇区直接从硬盘读入用户缓冲区,不经过cache
+static uint ReadDirect(FileDesc* fd, byte* buf, uint len)
+{
+    uint ret = 0;
+    uint idx = fd->objIdx + 1;
+    uint sctIdx = FindIndex(fd->fe.sctBegin, idx);
+
+    ToFlush(fd);
+
+    while( (sctIdx != SCT_END_FLAG) && ReadUserSector(sctIdx, AddrOff(buf, ret)) )
+    {
+        fd->objIdx = idx++;
+        fd->offset = SECT_SIZE;
+
+        ret += SECT_SIZE;
+
+        if( (ret + SECT_SIZE) <= len )
+        {
+            sctIdx = NextSector(sctIdx);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
 static uint ToRead(FileDesc* fd, byte* buf, uint len)
 {
     //计算最大可读取数据量
@@ -1064,14 +1165,21 @@ static uint ToRead(FileDesc* fd, byte* buf, uint len)
     {
         byte* p = AddrOff(buf, i);
         //缓冲区数据读完了，就需要从硬盘读入文件数据链表的下一个扇区到缓冲区中
-        if( fd->offset == SECT_SIZE )
+        if( (fd->offset == SECT_SIZE) && ((len - i) >= SECT_SIZE) )
         {
-            ret = PrepareCache(fd, fd->objIdx + 1);
+            ret = n = ReadDirect(fd, p, len - i);
         }
+        else
+        {
+            if( fd->offset == SECT_SIZE )
+            {
+                ret = PrepareCache(fd, fd->objIdx + 1);
+            }
 
-        if( ret )
-        {   //从缓冲区读取数据
-            n = CopyFromCache(fd, p, len - i); //len-i 还需要读取多少数据
+            if( ret )
+            {   //从缓冲区读取数据
+                n = CopyFromCache(fd, p, len - i); //len-i 还需要读取多少数据
+            }
         }
 
         i += n;
@@ -1195,3 +1303,237 @@ uint FFlush(uint fd)
 
     return ret;
 }
+
+//沿扇区链表找出一批扇区后统一提交给硬盘请求队列, 相邻扇区由驱动合并为一条多扇区命令
+//查找链表本身也需要读硬盘, 所以必须先找齐扇区再提交; buf只有len字节, 不完整的最后一个扇区
+//和不能直接用于DMA的扇区经内核缓冲区中转, 只复制buf能容纳的部分
+static uint ReadBatch(uint* sctIdx, byte* buf, uint len, uint cnt, uint more)
+{
+    HDRequest req[FS_BATCH_CNT];
+    byte* bounce = NULL;
+    uint ret = 1;
+    uint i = 0;
+
+    for(i=0; i<cnt; i++)
+    {
+        req[i].si = *sctIdx;
+        req[i].cnt = 1;
+        req[i].buf = (((i + 1) * SECT_SIZE) <= len) ? DmaBuf(AddrOff(buf, i * SECT_SIZE)) : NULL;
+        req[i].write = 0;
+        req[i].done = NULL;
+
+        if( !req[i].buf )
+        {
+            bounce = bounce ? bounce : Malloc(FS_BATCH_CNT * SECT_SIZE);
+            req[i].buf = bounce ? AddrOff(bounce, i * SECT_SIZE) : NULL;
+        }
+
+        *sctIdx = ((i + 1) < (cnt + more)) ? NextSector(*sctIdx) : SCT_END_FLAG;
+    }
+
+    for(i=0; i<cnt; i++)
+    {
+        ret = ret && (req[i].si != SCT_END_FLAG) && req[i].buf;
+    }
+
+    for(i=0; ret && (i<cnt); i++)
+    {
+        HDRawSubmit(req + i);
+    }
+
+    HDRawKick();
+
+    for(i=0; ret && (i<cnt); i++)
+    {
+        ret = req[i].result;
+
+        if( ret && bounce && (req[i].buf == AddrOff(bounce, i * SECT_SIZE)) )
+        {
+            MemCpy(AddrOff(buf, i * SECT_SIZE), req[i].buf, Min(len - i * SECT_SIZE, SECT_SIZE));
+        }
+    }
+
+    Free(bounce);
+
+    return ret;
+}
+
+//从pos(扇区对齐)开始按扇区直接读入buf,不经过缓冲区也不改变读写指针,超出文件长度的部分填0
+uint FReadAt(uint fd, uint pos, byte* buf, uint len)
+{
+    uint ret = 0;
+    FileDesc* pf = (FileDesc*)fd;
+
+    if( IsFDValid(pf) && buf && !(pos % SECT_SIZE) && FlushCache(pf) )
+    {
+        uint flen = GetFileLen(pf);
+        uint data = (pos < flen) ? Min(flen - pos, len) : 0;
+        uint sctNum = data / SECT_SIZE + !!(data % SECT_SIZE);
+        uint sctIdx = sctNum ? FindIndex(pf->fe.sctBegin, pos / SECT_SIZE) : SCT_END_FLAG;
+        uint i = 0;
+
+        ret = 1;
+
+        for(i=0; ret && (i<sctNum); i+=FS_BATCH_CNT)
+        {
+            uint cnt = Min(sctNum - i, FS_BATCH_CNT);
+
+            ret = ReadBatch(&sctIdx, AddrOff(buf, i * SECT_SIZE), len - i * SECT_SIZE, cnt, sctNum - i - cnt);
+        }
+
+        if( ret && (data < len) )
+        {
+            MemSet(AddrOff(buf, data), len - data, 0);
+        }
+    }
+
+    return ret;
+}
+
+#ifndef DTFSER
+
+//把用户文件名逐字节复制到内核缓冲区name中, 每进入新的一页时先检查; 超过NAME_BYTES - 1个字符的文件名无效, 返回NULL
+static const char* UserName(char* name, const char* uname)
+{
+    const char* ret = NULL;
+    uint valid = 1;
+    uint i = 0;
+
+    for(i=0; valid && !ret && (i<NAME_BYTES); i++)
+    {
+        valid = (i && ((uint)(uname + i) % PAGE_SIZE)) || TaskUserBuf(uname + i, 1, 0);
+
+        if( valid )
+        {
+            name[i] = uname[i];
+
+            ret = name[i] ? NULL : name;
+        }
+    }
+
+    return ret;
+}
+
+//文件描述符必须由当前任务打开, 不同文件之间互不影响
+static FileDesc* TaskFD(uint fd)
+{
+    FileDesc* ret = (FileDesc*)fd;
+
+    return (IsFDValid(ret) && (ret->owner == CurrentTaskId())) ? ret : NULL;
+}
+
+//文件已被其他任务打开时,当前任务进入此文件的等待队列,文件关闭后被唤醒并重新尝试
+static void SysFOpen(FSParam* param, const char* name)
+{
+    FileDesc* opened = name ? FindOpened(name) : NULL;
+
+    param->ret = 0;
+    param->wait = 0;
+
+    if( opened && (opened->owner != CurrentTaskId()) )
+    {
+        Event* evt = CreateEvent(FileEvent, (uint)&opened->wait, 0, 0);
+
+        if( evt )
+        {
+            param->wait = 1;
+
+            EventSchedule(WAIT, evt);
+        }
+    }
+    else if( !opened )
+    {
+        param->ret = (uint)OpenFile(name, CurrentTaskId());
+    }
+}
+
+//任务结束时关闭它通过系统调用打开且未关闭的文件, 唤醒等待这些文件的任务
+void FSTaskExit(uint id)
+{
+    ListNode* pos = gFDList.next;
+
+    while( id && !IsEqual(pos, &gFDList) )
+    {
+        FileDesc* fd = (FileDesc*)pos;
+
+        pos = pos->next;
+
+        if( fd->owner == id )
+        {
+            FClose((uint)fd);
+        }
+    }
+}
+
+void FSCallHandler(uint cmd, uint param1, uint param2)
+{
+    FSParam* param = (FSParam*)param1;
+    FileDesc* fd = NULL;
+    const char* fn = NULL;
+    char name[NAME_BYTES] = {0};
+    char nname[NAME_BYTES] = {0};
+
+    if( !TaskUserBuf(param, sizeof(*param), 1) )
+    {
+        return;
+    }
+
+    fd = ((5 <= cmd) && (cmd <= 13)) ? TaskFD(param->fd) : NULL;
+    fn = (cmd <= 4) ? UserName(name, param->name) : NULL;
+
+    switch(cmd)
+    {
+        case 0:
+            param->ret = FCreate(fn);
+            break;
+        case 1:
+            param->ret = FExisted(fn);
+            break;
+        case 2:
+            param->ret = FDelete(fn);
+            break;
+        case 3:
+            param->ret = FRename(fn, UserName(nname, param->nname));
+            break;
+        case 4:
+            SysFOpen(param, fn);
+            break;
+        case 5:
+            param->ret = (fd && TaskUserBuf(param->buf, param->len, 0)) ? FWrite((uint)fd, param->buf, param->len) : -1;
+            break;
+        case 6:
+            param->ret = (fd && TaskUserBuf(param->buf, param->len, 1)) ? FRead((uint)fd, param->buf, param->len) : -1;
+            break;
+        case 7:
+            if( fd )
+            {
+                FClose((uint)fd);
+            }
+            break;
+        case 8:
+            param->ret = fd ? FErase((uint)fd, param->len) : 0;
+            break;
+        case 9:
+            param->ret = fd ? FSeek((uint)fd, param->len) : -1;
+            break;
+        case 10:
+            param->ret = fd ? FLength((uint)fd) : -1;
+            break;
+        case 11:
+            param->ret = fd ? FTell((uint)fd) : -1;
+            break;
+        case 12:
+            param->ret = fd ? FFlush((uint)fd) : -1;
+            break;
+        case 13:
+            param->ret = fd ? FMap((uint)fd, param->pos, param->len) : 0;
+            break;
+        case 14:
+            param->ret = FUnmap((uint)param->buf);
+            break;
+        default:
+            break;
+    }
+}
+
+#endif
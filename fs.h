@@ -2,14 +2,7 @@
 #define FS_H
 
 #include "type.h"
-
-enum
-{
-    FS_FAILED,
-    FS_SUCCEED,
-    FS_EXISTED,
-    FS_NONEXISTED
-};
+#include "fsparam.h"
 
 void FSModInit();
 uint FSFormat();
@@ -29,6 +22,10 @@ uint FSeek(uint fd, uint pos);
 uint FLength(uint fd);
 uint FTell(uint fd);
 uint FFlush(uint fd);
+uint FReadAt(uint fd, uint pos, byte* buf, uint len);
+
+void FSCallHandler(uint cmd, uint param1, uint param2);
+void FSTaskExit(uint id);
 
 
 #endif
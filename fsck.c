@@ -0,0 +1,444 @@
+
+#define _FILE_OFFSET_BITS 64
+
+#include "fsdef.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//主机端fengyunFS离线一致性检查工具: mmap硬盘镜像, 多线程校验扇区链表
+//usage: fsck [-j threads] [-q] image
+
+#define OWNER_NONE     0
+#define OWNER_FREE     1
+#define OWNER_ROOT     2
+#define OWNER_FILE     3
+#define MAX_THREAD_NUM 64
+
+typedef struct
+{
+    const byte* image;      //mmap得到的镜像起始地址
+    uint sctNum;            //镜像中可用的扇区数
+    uint mapSize;           //扇区分配表占用的扇区数
+    uint dataBase;          //第一个数据扇区的绝对编号
+    uint dataNum;           //数据扇区数目
+    uint* owner;            //每个数据扇区归属于哪条链表
+    FileEntry* files;       //根目录中的全部FileEntry
+    uint fileNum;
+    uint nextJob;           //线程间共享的任务编号
+    uint errors;            //发现的错误总数
+    uint quiet;
+    pthread_mutex_t lock;   //串行化输出
+} FsckCtx;
+
+typedef struct
+{
+    FsckCtx* ctx;
+    uint mapBegin;          //本线程负责扫描的分配单元范围
+    uint mapEnd;
+} FsckWorker;
+
+static void Report(FsckCtx* ctx, const char* fmt, ...)
+{
+    __sync_fetch_and_add(&ctx->errors, 1);
+
+    if( !ctx->quiet )
+    {
+        va_list args;
+
+        pthread_mutex_lock(&ctx->lock);
+
+        va_start(args, fmt);
+        vfprintf(stdout, fmt, args);
+        va_end(args);
+
+        fputc('\n', stdout);
+
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
+static const byte* Sector(FsckCtx* ctx, uint si)
+{
+    return ctx->image + (size_t)si * SECT_SIZE;
+}
+
+//相对编号为rel的数据扇区对应的分配单元
+static uint MapEntry(FsckCtx* ctx, uint rel)
+{
+    const uint* map = (const uint*)Sector(ctx, FIXED_SCT_SIZE + rel / MAP_ITEM_CNT);
+
+    return map[rel % MAP_ITEM_CNT];
+}
+
+static const char* OwnerName(FsckCtx* ctx, uint id)
+{
+    const char* ret = "<unknown>";
+
+    if( id == OWNER_FREE )
+    {
+        ret = "<free list>";
+    }
+    else if( id == OWNER_ROOT )
+    {
+        ret = "<root>";
+    }
+    else if( (id - OWNER_FILE) < ctx->fileNum )
+    {
+        ret = ctx->files[id - OWNER_FILE].name;
+    }
+
+    return ret;
+}
+
+//沿扇区分配表遍历一条链表, rel为首扇区的相对编号, 返回成功认领的扇区数
+//同一个扇区被两条链表认领说明交叉链接, 被同一条链表认领两次说明存在环
+static uint WalkChain(FsckCtx* ctx, uint rel, uint id)
+{
+    uint ret = 0;
+
+    while( rel != SCT_END_FLAG )
+    {
+        uint prev = 0;
+
+        if( rel >= ctx->dataNum )
+        {
+            Report(ctx, "%s: sector index %u out of range (data sectors %u)", OwnerName(ctx, id), rel, ctx->dataNum);
+            break;
+        }
+
+        prev = __sync_val_compare_and_swap(&ctx->owner[rel], OWNER_NONE, id);
+
+        if( prev == id )
+        {
+            Report(ctx, "%s: cycle detected at sector %u", OwnerName(ctx, id), rel + ctx->dataBase);
+            break;
+        }
+        else if( prev != OWNER_NONE )
+        {
+            Report(ctx, "%s: sector %u cross-linked with %s", OwnerName(ctx, id), rel + ctx->dataBase, OwnerName(ctx, prev));
+            break;
+        }
+
+        ret++;
+
+        rel = MapEntry(ctx, rel);
+    }
+
+    return ret;
+}
+
+static uint ToRelative(FsckCtx* ctx, uint si)
+{
+    return (si == SCT_END_FLAG) ? SCT_END_FLAG : (si - ctx->dataBase);
+}
+
+static void CheckFreeList(FsckCtx* ctx)
+{
+    const FSHeader* header = (const FSHeader*)Sector(ctx, HEADER_SCT_IDX);
+    //AllocSector在空闲链表耗尽时将freeBegin写为SCT_END_FLAG + dataBase, 转换为相对编号后同样是SCT_END_FLAG
+    uint len = WalkChain(ctx, ToRelative(ctx, header->freeBegin), OWNER_FREE);
+
+    if( len != header->freeNum )
+    {
+        Report(ctx, "<free list>: header records %u free sectors, chain has %u", header->freeNum, len);
+    }
+}
+
+static void CheckFile(FsckCtx* ctx, uint i)
+{
+    FileEntry* fe = ctx->files + i;
+    uint len = WalkChain(ctx, ToRelative(ctx, fe->sctBegin), OWNER_FILE + i);
+
+    if( len != fe->sctNum )
+    {
+        Report(ctx, "%s: entry records %u sectors, chain has %u", fe->name, fe->sctNum, len);
+    }
+
+    if( fe->lastBytes > SECT_SIZE )
+    {
+        Report(ctx, "%s: lastBytes %u exceeds sector size", fe->name, fe->lastBytes);
+    }
+
+    if( !fe->sctNum && (fe->sctBegin != SCT_END_FLAG) )
+    {
+        Report(ctx, "%s: empty file owns sector %u", fe->name, fe->sctBegin);
+    }
+}
+
+static void* FsckThread(void* arg)
+{
+    FsckWorker* worker = (FsckWorker*)arg;
+    FsckCtx* ctx = worker->ctx;
+    uint i = 0;
+
+    //第一阶段: 分配单元取值范围检查
+    for(i=worker->mapBegin; i<worker->mapEnd; i++)
+    {
+        uint next = MapEntry(ctx, i);
+
+        if( (next != SCT_END_FLAG) && (next >= ctx->dataNum) )
+        {
+            Report(ctx, "map: sector %u links to invalid index %u", i + ctx->dataBase, next);
+        }
+    }
+
+    //第二阶段: 任务0为空闲链表, 任务1~n为各个文件的数据链表
+    while( (i = __sync_fetch_and_add(&ctx->nextJob, 1)) <= ctx->fileNum )
+    {
+        if( i == 0 )
+        {
+            CheckFreeList(ctx);
+        }
+        else
+        {
+            CheckFile(ctx, i - 1);
+        }
+    }
+
+    return NULL;
+}
+
+static uint CheckHeader(FsckCtx* ctx, size_t size)
+{
+    const FSHeader* header = (const FSHeader*)Sector(ctx, HEADER_SCT_IDX);
+    const FSRoot* root = (const FSRoot*)Sector(ctx, ROOT_SCT_IDX);
+    uint ret = 0;
+
+    if( strncmp(header->magic, FS_MAGIC, sizeof(header->magic)) )
+    {
+        fprintf(stderr, "bad filesystem magic, not a fengyunFS image\n");
+    }
+    else if( ((size_t)header->sctNum * SECT_SIZE > size) || (header->sctNum <= FIXED_SCT_SIZE) )
+    {
+        fprintf(stderr, "header records %u sectors, image holds %zu\n", header->sctNum, size / SECT_SIZE);
+    }
+    else if( ((size_t)header->mapSize * (MAP_ITEM_CNT + 1) < header->sctNum - FIXED_SCT_SIZE) ||
+             (header->mapSize >= header->sctNum - FIXED_SCT_SIZE) )
+    {
+        fprintf(stderr, "map size %u cannot describe %u sectors\n", header->mapSize, header->sctNum);
+    }
+    else
+    {
+        ctx->sctNum = header->sctNum;
+        ctx->mapSize = header->mapSize;
+        ctx->dataBase = FIXED_SCT_SIZE + header->mapSize;
+        ctx->dataNum = header->sctNum - ctx->dataBase;
+
+        if( strncmp(root->magic, ROOT_MAGIC, sizeof(root->magic)) )
+        {
+            Report(ctx, "<root>: bad root magic");
+        }
+
+        if( header->freeNum > ctx->dataNum )
+        {
+            Report(ctx, "header: free count %u exceeds data sectors %u", header->freeNum, ctx->dataNum);
+        }
+
+        ret = 1;
+    }
+
+    return ret;
+}
+
+static int CompareName(const void* left, const void* right)
+{
+    return strncmp(((const FileEntry*)left)->name, ((const FileEntry*)right)->name, sizeof(((FileEntry*)0)->name));
+}
+
+//根目录链表单线程遍历, 同时收集所有FileEntry供后续并行检查
+static void CheckRoot(FsckCtx* ctx)
+{
+    const FSRoot* root = (const FSRoot*)Sector(ctx, ROOT_SCT_IDX);
+    uint len = WalkChain(ctx, ToRelative(ctx, root->sctBegin), OWNER_ROOT);
+    uint rel = ToRelative(ctx, root->sctBegin);
+    uint i = 0;
+
+    if( len != root->sctNum )
+    {
+        Report(ctx, "<root>: root records %u sectors, chain has %u", root->sctNum, len);
+    }
+
+    if( (root->lastBytes > SECT_SIZE) || (root->lastBytes % FE_BYTES) )
+    {
+        Report(ctx, "<root>: invalid lastBytes %u", root->lastBytes);
+    }
+
+    ctx->files = calloc((size_t)len * FE_ITEM_CNT + 1, FE_BYTES);
+    ctx->fileNum = 0;
+
+    for(i=0; ctx->files && (i<len); i++)
+    {
+        const FileEntry* feBase = (const FileEntry*)Sector(ctx, rel + ctx->dataBase);
+        uint cnt = (i == (len - 1)) ? (root->lastBytes / FE_BYTES) : FE_ITEM_CNT;
+        uint j = 0;
+
+        for(j=0; (j<cnt) && (j<FE_ITEM_CNT); j++)
+        {
+            FileEntry* fe = ctx->files + ctx->fileNum++;
+
+            *fe = feBase[j];
+            fe->name[sizeof(fe->name) - 1] = 0;
+
+            if( (fe->inSctIdx != rel + ctx->dataBase) || (fe->inSctOff != j) )
+            {
+                Report(ctx, "%s: entry stored at %u:%u claims %u:%u", fe->name, rel + ctx->dataBase, j, fe->inSctIdx, fe->inSctOff);
+            }
+        }
+
+        rel = MapEntry(ctx, rel);
+    }
+
+    if( ctx->files && (ctx->fileNum > 1) )
+    {
+        FileEntry* sorted = malloc((size_t)ctx->fileNum * FE_BYTES);
+
+        if( sorted )
+        {
+            memcpy(sorted, ctx->files, (size_t)ctx->fileNum * FE_BYTES);
+            qsort(sorted, ctx->fileNum, FE_BYTES, CompareName);
+
+            for(i=1; i<ctx->fileNum; i++)
+            {
+                if( !CompareName(sorted + i - 1, sorted + i) )
+                {
+                    Report(ctx, "%s: duplicate file name", sorted[i].name);
+                }
+            }
+        }
+
+        free(sorted);
+    }
+}
+
+static void CheckLost(FsckCtx* ctx)
+{
+    uint lost = 0;
+    uint i = 0;
+
+    for(i=0; i<ctx->dataNum; i++)
+    {
+        lost += (ctx->owner[i] == OWNER_NONE);
+    }
+
+    if( lost )
+    {
+        Report(ctx, "%u sectors are neither free nor owned by any file", lost);
+    }
+}
+
+static uint RunCheck(FsckCtx* ctx, uint threads)
+{
+    pthread_t tid[MAX_THREAD_NUM];
+    FsckWorker worker[MAX_THREAD_NUM];
+    uint step = 0;
+    uint i = 0;
+
+    CheckRoot(ctx);
+
+    if( !ctx->files )
+    {
+        return 0;
+    }
+
+    step = ctx->dataNum / threads + 1;
+
+    for(i=0; i<threads; i++)
+    {
+        worker[i].ctx = ctx;
+        worker[i].mapBegin = (i * step < ctx->dataNum) ? (i * step) : ctx->dataNum;
+        worker[i].mapEnd = (worker[i].mapBegin + step < ctx->dataNum) ? (worker[i].mapBegin + step) : ctx->dataNum;
+
+        if( pthread_create(tid + i, NULL, FsckThread, worker + i) )
+        {
+            FsckThread(worker + i);
+            tid[i] = 0;
+        }
+    }
+
+    for(i=0; i<threads; i++)
+    {
+        if( tid[i] )
+        {
+            pthread_join(tid[i], NULL);
+        }
+    }
+
+    CheckLost(ctx);
+
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    FsckCtx ctx = {0};
+    uint threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* path = NULL;
+    struct stat st = {0};
+    int fd = -1;
+    int opt = 0;
+    int ret = 2;
+
+    while( (opt = getopt(argc, argv, "j:q")) != -1 )
+    {
+        switch(opt)
+        {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'q':
+                ctx.quiet = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j threads] [-q] image\n", argv[0]);
+                return ret;
+        }
+    }
+
+    path = (optind < argc) ? argv[optind] : NULL;
+    threads = (threads < 1) ? 1 : ((threads > MAX_THREAD_NUM) ? MAX_THREAD_NUM : threads);
+
+    if( !path )
+    {
+        fprintf(stderr, "usage: %s [-j threads] [-q] image\n", argv[0]);
+    }
+    else if( ((fd = open(path, O_RDONLY)) < 0) || fstat(fd, &st) || (st.st_size < FIXED_SCT_SIZE * SECT_SIZE) )
+    {
+        fprintf(stderr, "%s: cannot open image or image too small\n", path);
+    }
+    else if( (ctx.image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED )
+    {
+        fprintf(stderr, "%s: mmap failed\n", path);
+    }
+    else
+    {
+        pthread_mutex_init(&ctx.lock, NULL);
+
+        if( CheckHeader(&ctx, st.st_size) && (ctx.owner = calloc(ctx.dataNum, sizeof(uint))) && RunCheck(&ctx, threads) )
+        {
+            printf("%s: %u sectors, %u data, %u files, %u threads, %u errors\n",
+                   path, ctx.sctNum, ctx.dataNum, ctx.fileNum, threads, ctx.errors);
+
+            ret = !!ctx.errors;
+        }
+
+        free(ctx.owner);
+        free(ctx.files);
+
+        munmap((void*)ctx.image, st.st_size);
+    }
+
+    if( fd >= 0 )
+    {
+        close(fd);
+    }
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+
+#ifndef FSDEF_H
+#define FSDEF_H
+
+#include "type.h"
+#include "hdraw.h"
+
+//fengyunFS硬盘布局: 0号扇区FSHeader, 1号扇区FSRoot, 2~(mapSize+1)号扇区为扇区分配表, 之后为数据扇区
+//扇区分配表中每个分配单元存储后继数据扇区的相对编号(相对于第一个数据扇区), SCT_END_FLAG表示链表结束
+
+#define FS_MAGIC       "fengyunFS-v1.0"
+#define ROOT_MAGIC     "ROOT"
+#define HEADER_SCT_IDX 0
+#define ROOT_SCT_IDX   1
+#define FIXED_SCT_SIZE 2
+#define SCT_END_FLAG   ((uint)-1)
+#define FE_BYTES       sizeof(FileEntry)
+#define FE_ITEM_CNT    (SECT_SIZE / FE_BYTES)
+#define MAP_ITEM_CNT   (SECT_SIZE / sizeof(uint))
+
+//存储于0号引导区
+typedef struct
+{
+    byte forJmp[4];         //预留给jmp指令使用,万一0号扇区需要存储引导程序呢
+    char magic[32];         //存储字符串标识现在是什么文件系统
+    uint sctNum;            //多少扇区可以使用
+    uint mapSize;           //扇区分配表的大小
+    uint freeNum;           //空闲链表长度
+    uint freeBegin;         //空闲链表开始
+} FSHeader;
+
+//存储于1号根目录区
+typedef struct
+{
+    char magic[32];         //"ROOT"
+    uint sctBegin;          //根目录的开始扇区,本OS初始化时设置为1
+    uint sctNum;            //占用多少个扇区,本OS初始化设置为0非法值,表示还没有FileEntry
+    uint lastBytes;			//最后一个扇区用了多少字节
+} FSRoot;
+
+typedef struct
+{
+    char name[32];          //文件名
+    uint sctBegin;          //文件起始扇区
+    uint sctNum;            //多少个扇区
+    uint lastBytes;         //
+    uint type;              //是文件还是目录 存储的是用户数据还是文件相关的数据
+    uint inSctIdx;          //硬盘的哪一个扇区
+    uint inSctOff;			//扇区内偏移位置
+    uint reserved[2];		//预留
+} FileEntry;
+
+#endif
@@ -0,0 +1,28 @@
+
+#ifndef FSPARAM_H
+#define FSPARAM_H
+
+#include "type.h"
+
+enum
+{
+    FS_FAILED,
+    FS_SUCCEED,
+    FS_EXISTED,
+    FS_NONEXISTED
+};
+
+//文件系统调用参数, 应用与内核共用; 缓冲区直接传递用户地址, 文件名由内核复制到自己的缓冲区后使用
+typedef struct
+{
+    uint fd;            //文件描述符
+    const char* name;   //文件名
+    const char* nname;  //新文件名(FRename)
+    byte* buf;          //读写缓冲区/映射地址(FUnmap)
+    uint len;           //读写长度/定位位置/擦除字节数/映射长度
+    uint pos;           //映射起始偏移(FMap)
+    uint ret;           //返回值
+    uint wait;          //文件被其他任务占用时置1, 应用需要重新发起请求
+} FSParam;
+
+#endif
@@ -1,168 +1,288 @@
 #include "hdraw.h"
-#include "memory.h"
-
-#define ATA_IDENTIFY    0xEC
-#define ATA_READ        0x20
-#define ATA_WRITE       0x30
-
-#define REG_DEV_CTRL  0x3F6
-#define REG_DATA      0x1F0
-#define REG_FEATURES  0x1F1
-#define REG_ERROR     0x1F1
-#define REG_NSECTOR   0x1F2
-#define REG_LBA_LOW   0x1F3
-#define REG_LBA_MID   0x1F4
-#define REG_LBA_HIGH  0x1F5
-#define REG_DEVICE    0x1F6
-#define REG_STATUS    0x1F7
-#define REG_COMMAND   0x1F7
-
-#define	STATUS_BSY  0x80
-#define	STATUS_DRDY 0x40
-#define	STATUS_DFSE 0x20
-#define	STATUS_DSC  0x10
-#define	STATUS_DRQ  0x08
-#define	STATUS_CORR 0x04
-#define	STATUS_IDX  0x02
-#define	STATUS_ERR  0x01
-
-extern byte ReadPort(ushort port);
-extern void WritePort(ushort port, byte value);
-extern void ReadPortW(ushort port, ushort* buf, uint n);
-extern void WritePortW(ushort port, ushort* buf, uint n);
-
-typedef struct
-{
-    byte lbaLow;        //LBA24位
-    byte lbaMid;
-    byte lbaHigh;
-    byte device;        //
-    byte command;
-} HDRegValue;
-
-static uint IsBusy()
+#include "ata.h"
+#include "utility.h"
+
+#define HD_MAX_WAIT     16      //请求最多被越过的命令数,超过后优先调度
+
+static const HDDevice* gHDDev = NULL;
+static HDCommand gHDCmd[HD_MAX_SLOTS] = {0};
+static uint gHDBusy = 0;        //正在设备上执行的命令数
+static List gHDSorted = {0};
+static List gHDFifo = {0};
+static uint gHDSeq = 0;         //已发出的命令序号
+static uint gHDPos = 0;         //磁头位置: 上一条命令结束的扇区
+static HDRawStat gHDStat = {0};
+
+//默认使用主通道主盘
+void HDRawModInit()
 {
-    uint ret = 0;
-    uint i = 0;
+    List_Init(&gHDSorted);
+    List_Init(&gHDFifo);
+    
+    ATAModInit();
     
-    while( (i < 500) && (ret = (ReadPort(REG_STATUS) & STATUS_BSY)) )
+    gHDDev = ATAGetDevice();
+}
+
+//切换后续请求使用的块设备, 队列中尚有请求时不能切换
+void HDRawSetDevice(const HDDevice* dev)
+{
+    if( dev && List_IsEmpty(&gHDFifo) && !gHDBusy )
     {
-        i++;
+        gHDDev = dev;
+        gHDPos = 0;
     }
-    
-    return ret;
 }
 
-static uint IsDevReady()
+const HDDevice* HDRawGetDevice()
+{
+    return gHDDev;
+}
+
+uint HDRawSectors()
 {
-    return !(ReadPort(REG_STATUS) & STATUS_DRDY);
+    return gHDDev->sectors();
 }
 
-static uint IsDataReady()
+//按LBA顺序插入, LBA相同的请求保持提交顺序
+void HDRawSubmit(HDRequest* req)
 {
-    return ReadPort(REG_STATUS) & STATUS_DRQ;
+    if( req->cnt && req->buf && (req->cnt <= gHDDev->maxSectors()) &&
+        (req->si < HDRawSectors()) && (req->cnt <= (HDRawSectors() - req->si)) )
+    {
+        ListNode* pos = NULL;
+        
+        req->seq = gHDSeq;
+        req->result = 0;
+        
+        List_ForEach(&gHDSorted, pos)
+        {
+            if( ((HDRequest*)pos)->si > req->si )
+            {
+                break;
+            }
+        }
+        
+        List_AddBefore(pos, (ListNode*)req);
+        List_AddTail(&gHDFifo, &req->fifo);
+        
+        gHDStat.submitted++;
+        gHDStat.depth++;
+        gHDStat.maxDepth = Max(gHDStat.maxDepth, gHDStat.depth);
+    }
+    else
+    {
+        req->result = 0;
+        
+        if( req->done )
+        {
+            req->done(req);
+        }
+    }
 }
 
-static uint MakeDevRegVal(uint si)
+static uint IsCrossed(HDRequest* req, uint si, uint cnt)
 {
-    return 0xE0 | ((si >> 24) & 0x0F);
+    return (req->si < (si + cnt)) && (si < (req->si + req->cnt));
 }
 
-static HDRegValue MakeRegVals(uint si, uint action)
+//与正在执行的命令或更早提交且仍在排队的请求访问相同扇区的请求必须等待, 保证读写顺序; req必须在队列中
+static uint IsOverlapped(HDRequest* req)
 {
-    HDRegValue ret = {0};
+    uint ret = 0;
+    uint i = 0;
+    ListNode* pos = NULL;
     
-    ret.lbaLow = si & 0xFF;
-    ret.lbaMid = (si >> 8) & 0xFF;
-    ret.lbaHigh = (si >> 16) & 0xFF;
-    ret.device = MakeDevRegVal(si);
-    ret.command = action;
+    for(i=0; !ret && (i<Dim(gHDCmd)); i++)
+    {
+        HDCommand* cmd = gHDCmd + i;
+        
+        ret = cmd->busy && IsCrossed(req, cmd->si, cmd->cnt);
+    }
+    
+    for(pos=gHDFifo.next; !ret && !IsEqual(pos, &req->fifo); pos=pos->next)
+    {
+        HDRequest* prev = List_Node(pos, HDRequest, fifo);
+        
+        ret = IsCrossed(req, prev->si, prev->cnt);
+    }
     
     return ret;
 }
 
-static void WritePorts(HDRegValue hdrv)
+//C-LOOK: 选择磁头位置之后LBA最小的请求,到达末尾后回到LBA最小处; 最早的请求等待过久时优先调度
+//选中的请求与更早的请求重叠时改为调度最早的请求, 最早的请求只可能与正在执行的命令重叠
+static HDRequest* NextRequest()
 {
-    WritePort(REG_FEATURES, 0);                     //
-    WritePort(REG_NSECTOR, 1);                      //每次只操作一个扇区
-    WritePort(REG_LBA_LOW, hdrv.lbaLow);            //LBA的地址
-    WritePort(REG_LBA_MID, hdrv.lbaMid);
-    WritePort(REG_LBA_HIGH, hdrv.lbaHigh);          
-    WritePort(REG_DEVICE, hdrv.device);             //操作哪块硬盘
-    WritePort(REG_COMMAND, hdrv.command);           //指定命令块寄存器值 读/写
+    HDRequest* ret = List_Node(gHDFifo.next, HDRequest, fifo);
+    
+    if( (gHDSeq - ret->seq) <= HD_MAX_WAIT )
+    {
+        ListNode* pos = NULL;
+        
+        ret = (HDRequest*)gHDSorted.next;
         
-    WritePort(REG_DEV_CTRL, 0);                     //控制块命令字
+        List_ForEach(&gHDSorted, pos)
+        {
+            if( ((HDRequest*)pos)->si >= gHDPos )
+            {
+                ret = (HDRequest*)pos;
+                break;
+            }
+        }
+        
+        if( IsOverlapped(ret) )
+        {
+            ret = List_Node(gHDFifo.next, HDRequest, fifo);
+        }
+    }
+    
+    return ret;
 }
 
-void HDRawModInit()
+static void RemoveRequest(HDRequest* req)
 {
-
+    List_DelNode((ListNode*)req);
+    List_DelNode(&req->fifo);
+    
+    gHDStat.depth--;
 }
 
-uint HDRawSectors()
+//正在执行的命令少于设备槽位数时, 最小的空闲下标一定小于槽位数, 设备可以直接用tag作为槽位号
+static HDCommand* AllocCommand()
 {
-    static uint ret = -1;
+    HDCommand* ret = NULL;
+    uint i = 0;
     
-    if( (ret == -1) && IsDevReady() )
+    for(i=0; !ret && (i<Dim(gHDCmd)); i++)
     {
-        HDRegValue hdrv = MakeRegVals(0, ATA_IDENTIFY);//0xEC获取硬盘信息
-        byte* buf = Malloc(SECT_SIZE);
-        
-        WritePorts(hdrv);
-        
-        if( !IsBusy() && IsDataReady() && buf )
+        if( !gHDCmd[i].busy )
         {
-            ushort* data = (ushort*)buf;
-            
-            ReadPortW(REG_DATA, data, SECT_SIZE >> 1);
-            
-            ret = (data[61] << 16) | (data[60]);
+            ret = gHDCmd + i;
+            ret->busy = 1;
+            ret->tag = i;
         }
-        
-        Free(buf);
     }
     
     return ret;
 }
 
-uint HDRawWrite(uint si, byte* buf)
+//从first开始合并后续LBA连续且读写方向相同的请求,发出一条多扇区命令
+static void Dispatch(HDRequest* first)
 {
-    uint ret = 0;
+    HDCommand* cmd = AllocCommand();
+    HDRequest* req = first;
+    uint segs = 0;
+    
+    List_Init(&cmd->reqs);
+    
+    cmd->si = first->si;
+    cmd->cnt = 0;
+    cmd->write = first->write;
+    
+    if( (gHDSeq - first->seq) > HD_MAX_WAIT )
+    {
+        gHDStat.expired++;
+    }
     
-    if( (si < HDRawSectors()) && buf && !IsBusy() )
+    do
     {
-        HDRegValue hdrv = MakeRegVals(si, ATA_WRITE);
+        HDRequest* next = IsEqual(req->head.next, &gHDSorted) ? NULL : (HDRequest*)req->head.next;
+        
+        RemoveRequest(req);
+        List_AddTail(&cmd->reqs, (ListNode*)req);
         
-        WritePorts(hdrv);
+        cmd->cnt += req->cnt;
+        segs++;
         
-        if( ret = (!IsBusy() && IsDataReady()) )
+        if( next && (next->write == cmd->write) && (next->si == (cmd->si + cmd->cnt)) &&
+            ((cmd->cnt + next->cnt) <= gHDDev->maxSectors()) && (segs < gHDDev->maxSegments) && !IsOverlapped(next) )
         {
-            ushort* data = (ushort*)buf;
+            gHDStat.merged++;
             
-            WritePortW(REG_DATA, data, SECT_SIZE >> 1);
+            req = next;
+        }
+        else
+        {
+            req = NULL;
         }
     }
+    while( req );
     
-    return ret;
+    gHDSeq++;
+    gHDPos = cmd->si + cmd->cnt;
+    gHDStat.commands++;
+    gHDBusy++;
+    
+    gHDDev->issue(cmd);
 }
 
-uint HDRawRead(uint si, byte* buf)
+//设备在命令完成或失败后调用, 命令中的请求依次回调
+void HDRawComplete(HDCommand* cmd, uint ok)
 {
-    uint ret = 0;
+    while( !List_IsEmpty(&cmd->reqs) )
+    {
+        HDRequest* req = (HDRequest*)cmd->reqs.next;
+        
+        List_DelNode((ListNode*)req);
+        
+        req->result = ok;
+        
+        if( req->done )
+        {
+            req->done(req);
+        }
+    }
     
-    if( (si < HDRawSectors()) && buf && !IsBusy() )
+    cmd->busy = 0;
+    gHDBusy--;
+}
+
+//处理队列中的全部请求直到设备空闲, 完成回调中提交的新请求也会在本次处理
+//设备有空闲槽位时持续发出命令, 否则等待已发出的命令完成
+void HDRawKick()
+{
+    while( !List_IsEmpty(&gHDFifo) || gHDBusy )
     {
-        HDRegValue hdrv = MakeRegVals(si, ATA_READ);
-        //
-        WritePorts(hdrv);
+        HDRequest* req = (!List_IsEmpty(&gHDFifo) && (gHDBusy < gHDDev->slots)) ? NextRequest() : NULL;
         
-        if( ret = (!IsBusy() && IsDataReady()) )
+        if( req && !IsOverlapped(req) )
         {
-            ushort* data = (ushort*)buf;
-            
-            ReadPortW(REG_DATA, data, SECT_SIZE >> 1);
+            Dispatch(req);
+        }
+        else
+        {
+            gHDDev->poll();
         }
     }
+}
+
+const HDRawStat* HDRawGetStat()
+{
+    return &gHDStat;
+}
+
+static uint DoRequest(uint si, byte* buf, uint write)
+{
+    HDRequest req = {0};
     
-    return ret;
+    req.si = si;
+    req.cnt = 1;
+    req.buf = buf;
+    req.write = write;
+    
+    HDRawSubmit(&req);
+    HDRawKick();
+    
+    return req.result;
+}
+
+uint HDRawWrite(uint si, byte* buf)
+{
+    return DoRequest(si, buf, 1);
+}
+
+uint HDRawRead(uint si, byte* buf)
+{
+    return DoRequest(si, buf, 0);
 }
@@ -2,12 +2,71 @@
 #define HDRAW_H
 
 #include "type.h"
+#include "list.h"
 
-#define SECT_SIZE    512
+#define SECT_SIZE      512
+#define HD_MAX_SLOTS   32           //同时执行的命令数上限
+#define HD_MAX_SCT_NUM 0xFFFFFFFE   //扇区号为32位, 0xFFFFFFFF留作无效值
+
+typedef struct _HDRequest HDRequest;
+
+//硬盘请求, 按LBA排序后由电梯算法调度, 相邻请求合并为一条多扇区命令
+struct _HDRequest
+{
+    ListNode head;                  //按LBA排序的请求队列
+    ListNode fifo;                  //按提交顺序排列的请求队列,用于判断请求是否等待过久
+    uint si;                        //起始扇区
+    uint cnt;                       //扇区数
+    byte* buf;                      //数据缓冲区, cnt * SECT_SIZE字节
+    uint write;                     //1为写请求, 0为读请求
+    uint seq;                       //提交时的命令序号
+    uint result;                    //1为成功, 0为失败
+    void (*done)(HDRequest* req);   //请求完成回调,可以为NULL
+};
+
+//成员顺序与应用端GetDiskStat的编号一致
+typedef struct
+{
+    uint submitted;                 //提交的请求数
+    uint commands;                  //实际发出的硬盘命令数
+    uint merged;                    //被合并到其他命令中的请求数
+    uint expired;                   //等待超时而被优先调度的请求数
+    uint depth;                     //当前队列深度
+    uint maxDepth;                  //历史最大队列深度
+} HDRawStat;
+
+typedef struct
+{
+    List reqs;                      //命令包含的请求, 按LBA顺序通过head连接
+    uint si;                        //起始扇区
+    uint cnt;                       //扇区数
+    uint write;                     //1为写命令, 0为读命令
+    uint tag;                       //槽位号, 小于设备的slots
+    uint busy;                      //是否正在执行
+} HDCommand;
+
+//块设备: 请求队列排序合并成命令后交给issue, 设备在命令完成后调用HDRawComplete
+typedef struct
+{
+    const char* name;
+    uint slots;                                 //最多同时执行的命令数, 不超过HD_MAX_SLOTS
+    uint maxSegments;                           //一条命令最多包含的请求数
+    uint (*sectors)();                          //扇区总数, 设备不可用时返回-1
+    uint (*maxSectors)();                       //一条命令最多传输的扇区数
+    void (*issue)(HDCommand* cmd);              //发出命令
+    void (*poll)();                             //等待至少一条命令完成; 在issue中就完成命令的设备可以为NULL
+} HDDevice;
 
 void HDRawModInit();
+void HDRawSetDevice(const HDDevice* dev);
+const HDDevice* HDRawGetDevice();
 uint HDRawSectors();
 uint HDRawWrite(uint si, byte* buf);
 uint HDRawRead(uint si, byte* buf);
 
+void HDRawSubmit(HDRequest* req);
+void HDRawKick();
+void HDRawComplete(HDCommand* cmd, uint ok);
+const HDRawStat* HDRawGetStat();
+
 #endif
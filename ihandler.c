@@ -5,6 +5,8 @@
 #include "mutex.h"
 #include "screen.h"
 #include "sysinfo.h"
+#include "fs.h"
+#include "fmap.h"
 
 extern byte ReadPort(ushort port);
 
@@ -29,13 +31,18 @@ void KeyboardHandler()
     PutScanCode(sc);
     //通知所有等待键盘输入的任务
     NotifyKeyCode();
+    //等待按键的任务(如Shell)级别更高时立即切换过去
+    TaskPreempt();
     
     SendEOI(MASTER_EOI_PORT);
 }
 
 //80号中断会触发调用此中断处理函数
 void SysCallHandler(uint type, uint cmd, uint param1, uint param2)   // __cdecl__
-{   //type中断功能号
+{   //参数可能是指向用户内存的指针, 内核访问前先装入按需分配的页并解除写时复制
+    TaskPageIn(param1);
+    TaskPageIn(param2);
+    //type中断功能号
     switch(type)
     {
         case 0: //任务函数调用
@@ -50,19 +57,27 @@ void SysCallHandler(uint type, uint cmd, uint param1, uint param2)   // __cdecl_
         case 3:
             SysInfoCallHandler(cmd, param1, param2);
             break;
+        case 4:
+            FSCallHandler(cmd, param1, param2);
+            break;
         default:
             break;
     }
 }
 
 void PageFaultHandler()
-{
-    SetPrintPos(ERR_START_W, ERR_START_H);
-    
-    PrintString("Page Fault: kill ");
-    PrintString(CurrentTaskName());
+{   //文件映射区域的缺页在此装入数据, 已保留的堆和私有区域按需映射清零的页, 返回后重新执行引起缺页的指令
+    uint addr = GetFaultAddr();
     
-    KillTask();
+    if( !FMapFault(addr) && !TaskDemandPage(addr) )
+    {
+        SetPrintPos(ERR_START_W, ERR_START_H);
+        
+        PrintString("Page Fault: kill ");
+        PrintString(CurrentTaskName());
+        
+        KillTask();
+    }
 }
 
 void SegmentFaultHandler()
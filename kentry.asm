@@ -11,6 +11,8 @@ global ReadPort
 global WritePort
 global ReadPortW
 global WritePortW
+global ReadPortL
+global WritePortL
 
 extern TimerHandler
 extern KeyboardHandler
@@ -257,3 +259,40 @@ SegmentFaultHandlerEntry:
 BeginFSR
     call SegmentFaultHandler
 EndISR
+
+;
+; uint ReadPortL(ushort port)
+;
+ReadPortL:
+    push ebp
+    mov  ebp, esp
+    
+    mov dx, [ebp + 8]
+    in  eax, dx
+    
+    nop
+    nop
+    nop
+    
+    leave
+    
+    ret
+
+;
+; void WritePortL(ushort port, uint value)
+;
+WritePortL:
+    push ebp
+    mov  ebp, esp
+    
+    mov dx, [ebp + 8]
+    mov eax, [ebp + 12]
+    out dx, eax
+    
+    nop
+    nop
+    nop
+    
+    leave
+    
+    ret
@@ -1,4 +1,16 @@
 #include "kernel.h"
+#include "page.h"
+#include "utility.h"
+
+#define PDE_SHIFT        22
+#define PTE_NUM          (PAGE_SIZE / sizeof(uint))
+#define SPACE_PDE_BEGIN  (TaskSpaceBase >> PDE_SHIFT)
+#define SPACE_PDE_END    ((TaskSpaceBase + TaskSpaceSize) >> PDE_SHIFT)
+#define LARGE_PAGE_SIZE  (1 << PDE_SHIFT)
+#define CPUID_PSE        (1 << 3)
+#define CPUID_PGE        (1 << 13)
+#define CR4_PSE          (1 << 4)
+#define CR4_PGE          (1 << 7)
 
 GdtInfo gGdtInfo = {0};
 IdtInfo gIdtInfo = {0};
@@ -49,5 +61,242 @@ void ConfigPageTable()
         
         *addr = value;
     }
+    
+    //任务的段界限覆盖到私有区域末尾, 低4MB中内核堆之后除显存外都只允许内核访问
+    for(i=KernelHeapBase/PAGE_SIZE; i<PTE_NUM; i++)
+    {
+        uint page = i * PAGE_SIZE;
+        
+        if( (page < 0xB8000) || (page >= 0xC0000) )
+        {
+            TblBase[i] &= ~PG_USU;
+            
+            FlushPage(page);
+        }
+    }
+}
+
+static uint CpuFeature()
+{
+    uint ret = 0;
+    
+    asm volatile("cpuid" : "=d"(ret) : "a"(1) : "ebx", "ecx");
+    
+    return ret;
+}
+
+//4MB到end(按4MB向下取整)之间的内存只有内核使用(内核堆, 页分配器管理的页), 改用4MB大页恒等映射,
+//CPU支持时标记为全局页, 切换页目录时不会被刷出TLB; 低4MB中有应用的页且属性会变化, 仍使用4KB页
+void ConfigLargePage(uint end)
+{
+    uint* DirBase = (void*)PageDirBase;
+    uint  feature = CpuFeature();
+    uint  cr4 = 0;
+    uint  i = 0;
+    
+    if( feature & CPUID_PSE )
+    {
+        asm volatile("movl %%cr4, %0" : "=r"(cr4));
+        
+        cr4 |= CR4_PSE;
+        
+        asm volatile("movl %0, %%cr4" : : "r"(cr4));
+        
+        for(i=1; i<end/LARGE_PAGE_SIZE; i++)
+        {
+            DirBase[i] = (i * LARGE_PAGE_SIZE) | PG_P | PG_RWW | PG_PS | ((feature & CPUID_PGE) ? PG_G : 0);
+        }
+        
+        SetPageDir(PageDirBase);
+        
+        if( feature & CPUID_PGE )
+        {
+            cr4 |= CR4_PGE;
+            
+            asm volatile("movl %0, %%cr4" : : "r"(cr4));
+        }
+    }
+}
+
+//全局页表连续存放于PageTblBase,线性地址的高20位即页表项下标
+uint* GetPageEntry(uint addr)
+{
+    return (uint*)PageTblBase + addr / PAGE_SIZE;
+}
+
+//页目录dir中线性地址addr的页表项; 页表不存在且alloc不为0时分配一个清零的页表, 失败或addr位于4MB大页时返回NULL
+uint* GetDirPageEntry(uint dir, uint addr, uint alloc)
+{
+    uint* ret = NULL;
+    uint* pde = (uint*)dir + (addr >> PDE_SHIFT);
+    
+    if( !(*pde & PG_P) && alloc )
+    {
+        uint* tbl = PageAlloc();
+        
+        if( tbl )
+        {
+            MemSet((byte*)tbl, PAGE_SIZE, 0);
+            
+            *pde = (uint)tbl | PG_P | PG_RWW | PG_USU;
+        }
+    }
+    
+    if( (*pde & PG_P) && !(*pde & PG_PS) )
+    {
+        ret = (uint*)PageFrame(*pde) + ((addr / PAGE_SIZE) % PTE_NUM);
+    }
+    
+    return ret;
+}
+
+//页目录dir中addr所在页的页目录项与页表项都包含flag中的所有位时返回1, 两者的权限同时生效
+uint IsPageAllowed(uint dir, uint addr, uint flag)
+{
+    uint* pde = (uint*)dir + (addr >> PDE_SHIFT);
+    uint* pte = GetDirPageEntry(dir, addr, 0);
+    
+    return pte && ((*pde & flag) == flag) && ((*pte & flag) == flag);
+}
+
+//任务页目录由全局页目录复制而来: 低4MB(内核与应用)的页表为所有任务共享,
+//其余恒等映射只允许内核访问, 私有区域开始时为空, 由任务自己的页表映射
+uint CreatePageDir()
+{
+    uint* ret = PageAlloc();
+    uint* gdir = (uint*)PageDirBase;
+    uint i = 0;
+    
+    for(i=0; ret && (i<PTE_NUM); i++)
+    {
+        if( (i >= SPACE_PDE_BEGIN) && (i < SPACE_PDE_END) )
+        {
+            ret[i] = 0;
+        }
+        else
+        {
+            ret[i] = i ? (gdir[i] & ~PG_USU) : gdir[i];
+        }
+    }
+    
+    return (uint)ret;
+}
+
+//释放私有区域的物理页和页表, 再释放页目录本身; 调用前不能正在使用dir
+void DestroyPageDir(uint dir)
+{
+    uint* pd = (uint*)dir;
+    uint i = 0;
+    uint j = 0;
+    
+    if( pd && (dir != PageDirBase) )
+    {
+        for(i=SPACE_PDE_BEGIN; i<SPACE_PDE_END; i++)
+        {
+            if( pd[i] & PG_P )
+            {
+                uint* tbl = (uint*)PageFrame(pd[i]);
+                
+                for(j=0; j<PTE_NUM; j++)
+                {
+                    if( tbl[j] & PG_P )
+                    {
+                        PageFree((void*)PageFrame(tbl[j]));
+                    }
+                }
+                
+                PageFree(tbl);
+            }
+        }
+        
+        PageFree(pd);
+    }
+}
+
+//复制页目录dir: 私有区域中已映射的页由两个页目录共享, 都改为只读并标记写时复制; 内存不足时返回0
+//调用者需要刷新dir的TLB
+uint ForkPageDir(uint dir)
+{
+    uint ret = CreatePageDir();
+    uint* pd = (uint*)dir;
+    uint i = 0;
+    uint j = 0;
+    
+    for(i=SPACE_PDE_BEGIN; ret && (i<SPACE_PDE_END); i++)
+    {
+        uint* tbl = (pd[i] & PG_P) ? (uint*)PageFrame(pd[i]) : NULL;
+        uint* copy = tbl ? PageAlloc() : NULL;
+        
+        if( copy )
+        {
+            for(j=0; j<PTE_NUM; j++)
+            {
+                if( tbl[j] & PG_P )
+                {
+                    tbl[j] = (tbl[j] & ~PG_RWW) | PG_COW;
+                    
+                    PageShare((void*)PageFrame(tbl[j]));
+                }
+                
+                copy[j] = tbl[j];
+            }
+            
+            ((uint*)ret)[i] = (uint)copy | (pd[i] & (PAGE_SIZE - 1));
+        }
+        else if( tbl )
+        {
+            DestroyPageDir(ret);
+            
+            ret = 0;
+        }
+    }
+    
+    return ret;
+}
+
+//写时复制: 物理页仍被其他页目录共享时复制一份给pte, 否则直接恢复可写; 内存不足时返回0
+uint CopyOnWrite(uint* pte)
+{
+    uint ret = 1;
+    void* frame = (void*)PageFrame(*pte);
+    
+    if( PageShared(frame) )
+    {
+        void* copy = PageAlloc();
+        
+        if( ret = !!copy )
+        {
+            MemCpy((byte*)copy, (byte*)frame, PAGE_SIZE);
+            
+            PageFree(frame);
+            
+            *pte = (uint)copy | (*pte & (PAGE_SIZE - 1));
+        }
+    }
+    
+    if( ret )
+    {
+        *pte = (*pte | PG_RWW) & ~PG_COW;
+    }
+    
+    return ret;
 }
 
+void SetPageDir(uint dir)
+{
+    asm volatile("movl %0, %%cr3" : : "r"(dir) : "memory");
+}
+
+void FlushPage(uint addr)
+{
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+uint GetFaultAddr()
+{
+    uint ret = 0;
+    
+    asm volatile("movl %%cr2, %0" : "=r"(ret));
+    
+    return ret;
+}
@@ -5,6 +5,8 @@
 #include "type.h"
 #include "const.h"
 
+#define PageFrame(pte)  ((pte) & ~(PAGE_SIZE - 1))
+
 typedef struct {
     ushort limit1;          //段界限0~15
     ushort base1;           //基地址0~15
@@ -40,5 +42,16 @@ extern IdtInfo gIdtInfo;
 int SetDescValue(Descriptor* pDesc, uint base, uint limit, ushort attr);
 int GetDescValue(Descriptor* pDesc, uint* pBase, uint* pLimit, ushort* pAttr);
 void ConfigPageTable();
+void ConfigLargePage(uint end);
+uint* GetPageEntry(uint addr);
+uint* GetDirPageEntry(uint dir, uint addr, uint alloc);
+uint IsPageAllowed(uint dir, uint addr, uint flag);
+uint CreatePageDir();
+void DestroyPageDir(uint dir);
+uint ForkPageDir(uint dir);
+uint CopyOnWrite(uint* pte);
+void SetPageDir(uint dir);
+void FlushPage(uint addr);
+uint GetFaultAddr();
 
 #endif
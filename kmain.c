@@ -5,11 +5,66 @@
 #include "mutex.h"
 #include "keyboard.h"
 #include "fs.h"
+#include "fmap.h"
+#include "page.h"
+#include "ramdisk.h"
+#include "virtblk.h"
+#include "ahci.h"
+#include "raid0.h"
+#include "sysinfo.h"
+
+#define RAMDISK_SIZE  0x800000
+#define KHEAP_DIV     32            //内核堆占物理内存的1/32
+#define KHEAP_MAX     0x400000
+
+static void* KHeapGrow(uint* size)
+{
+    uint pages = 1;
+    
+    while( pages * PAGE_SIZE < *size )
+    {
+        pages <<= 1;
+    }
+    
+    *size = pages * PAGE_SIZE;
+    
+    return PageAllocN(pages);
+}
+
+static void KHeapShrink(void* mem, uint size)
+{
+    PageFree(mem);
+}
+
+//内核堆从物理页分配器中取得, 随物理内存大小伸缩; 内存不足时退回固定的KernelHeapBase区域
+//之后堆用完时继续向物理页分配器申请, 扩展出的区域整体空闲时归还
+static void KHeapModInit()
+{
+    uint size = HeapSize;
+    byte* heap = NULL;
+    
+    while( (size < KHEAP_MAX) && (size < gMemSize / KHEAP_DIV) )
+    {
+        size <<= 1;
+    }
+    
+    if( (heap = PageAllocN(size / PAGE_SIZE)) )
+    {
+        MemModInit(heap, size);
+    }
+    else
+    {
+        MemModInit((byte*)KernelHeapBase, HeapSize);
+    }
+    
+    MemSetGrow(KHeapGrow, KHeapShrink);
+}
 
 void KMain()
 {
     void (*AppModInit)() = (void*)BaseOfApp;
     byte* pn = (byte*)0x475;
+    const HDDevice* pd = NULL;
     
     PrintString("fengyun.OS\n");
     
@@ -33,13 +88,45 @@ void KMain()
     PrintIntDec(*pn);
     PrintChar('\n');
     
-    MemModInit((byte*)KernelHeapBase, HeapSize);
+    //私有区域之上的物理内存不交给页分配器, 所有任务的页目录中内核都能恒等访问其管理的页
+    PageModInit(FreePageBase, Min(gMemSize, TaskSpaceBase));
+    
+    ConfigLargePage(Min(gMemSize, TaskSpaceBase));
+    
+    KHeapModInit();
     
     KeyboardModInit();
     
     MutexModInit();
     
-    HDRawModInit();
+    FSModInit();
+    
+    //依次尝试virtio-blk, AHCI和IDE; 没有硬盘时使用内存盘, 文件系统照常格式化和挂载
+    //有多块IDE硬盘且主盘上没有单盘文件系统时, 把它们组成RAID-0
+    if( (pd = VirtBlkModInit()) || (pd = AHCIModInit()) )
+    {
+        HDRawSetDevice(pd);
+    }
+    else if( (*pn == 0) && (pd = RamDiskModInit(RAMDISK_SIZE)) )
+    {
+        HDRawSetDevice(pd);
+        
+        FSFormat();
+    }
+    else if( (*pn > 1) && !FSIsFormatted() && (pd = Raid0ModInit()) )
+    {
+        HDRawSetDevice(pd);
+    }
+    
+    PrintString("Disk Device: ");
+    PrintString(HDRawGetDevice()->name);
+    PrintChar('\n');
+    
+    PrintString("Disk Sectors: ");
+    PrintIntDec(HDRawSectors());
+    PrintChar('\n');
+    
+    FMapModInit();
     
     PrintIntDec(FSIsFormatted());
     
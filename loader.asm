@@ -356,6 +356,8 @@ RunTask:
 
     lldt word [esp + 96]    ; lldt pt->ldtSelector 加载局部段描述符表  Task结构的偏移可以计算，ldt位于96
     ltr word [esp + 98]     ; ltr pt->tssSelector  加载任务状态段
+    mov eax, [esp + 100]    ; 切换到任务的页目录 pt->cr3, eax随后由popad恢复
+    mov cr3, eax
     pop gs                  ; 开始修改寄存器的值
     pop fs
     pop es
@@ -393,6 +395,12 @@ LoadTask:
     
     lldt word [eax + 96]    ;lldt加载pt偏移200的地方即局部段描述符的位置
     ; 由于所有任务共用同一个TSS，不需要重新加载TSS
+    mov eax, [eax + 100]    ; pt->cr3, 与当前页目录相同时不重新加载, 避免刷新TLB
+    mov ecx, cr3
+    cmp eax, ecx
+    je .same
+    mov cr3, eax
+.same:
     leave
     
     ret
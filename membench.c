@@ -0,0 +1,483 @@
+
+//宿主机上运行的内存分配器基准测试: 按fs.c等内核模块的分配模式测量memory.c的Malloc/Free
+//每种模式先整体计时得到吞吐量, 再逐次计时重放一遍得到最坏延迟(含一次clock_gettime的开销)
+//最后随机混合各种分配接口并校验对象内容, 检查分配器是否破坏数据
+//用法: membench [次数] [轨迹文件], 轨迹文件每行为"m <编号> <字节数>"或"f <编号>"
+//编译: make tools, 按64位程序编译, -no-pie使堆位于4GB以下, memory.c中用uint保存的地址不会被截断
+//内核源文件中指针与uint之间的转换因此是安全的, makefile关闭了这两种转换的警告; 本文件自己的转换使用uintptr_t
+
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define HEAP_SIZE   0x20000     //与内核堆大小一致
+#define LIVE_NUM    64
+#define FUZZ_NUM    256
+#define TRACE_NUM   4096
+
+typedef struct
+{
+    byte* ptr;
+    uint size;
+    byte seed;
+} FuzzObj;
+
+static byte gHeap[HEAP_SIZE] __attribute__((aligned(0x1000)));
+static void* gLive[LIVE_NUM];
+static void* gTrace[TRACE_NUM];
+static FuzzObj gFuzz[FUZZ_NUM];
+static uint gTiming = 0;        //为1时逐次计时
+static double gWorst = 0;
+
+static double Now()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void Worst(double begin)
+{
+    double time = Now() - begin;
+    
+    if( time > gWorst )
+    {
+        gWorst = time;
+    }
+}
+
+static void* BMalloc(uint size)
+{
+    void* ret = NULL;
+    
+    if( gTiming )
+    {
+        double begin = Now();
+        
+        ret = Malloc(size);
+        
+        Worst(begin);
+    }
+    else
+    {
+        ret = Malloc(size);
+    }
+    
+    return ret;
+}
+
+static void BFree(void* ptr)
+{
+    if( gTiming )
+    {
+        double begin = Now();
+        
+        Free(ptr);
+        
+        Worst(begin);
+    }
+    else
+    {
+        Free(ptr);
+    }
+}
+
+//先整体计时跑一遍, 再逐次计时跑一遍, 两次操作序列相同
+static void Run(const char* name, uint(*pattern)(uint, uint*), uint n)
+{
+    double begin = Now();
+    uint fails = 0;
+    uint ops = pattern(n, &fails);
+    double time = Now() - begin;
+    uint dummy = 0;
+    
+    gTiming = 1;
+    gWorst = 0;
+    
+    pattern(n, &dummy);
+    
+    gTiming = 0;
+    
+    printf("%-12s %10u ops %8.1f ns/op %8.0f ns worst %8u failed\n", name, ops, time / ops, gWorst, fails);
+}
+
+//ReadSector: 申请512字节缓冲区, 读完立即释放, 同时有若干打开的文件描述符占用内存
+static uint SectorPattern(uint n, uint* fails)
+{
+    void* fd[16] = {0};
+    uint i = 0;
+    
+    for(i=0; i<16; i++)
+    {
+        *fails += !(fd[i] = BMalloc(600));
+    }
+    
+    for(i=0; i<n; i++)
+    {
+        void* p = BMalloc(512);
+        
+        *fails += !p;
+        
+        BFree(p);
+    }
+    
+    for(i=0; i<16; i++)
+    {
+        BFree(fd[i]);
+    }
+    
+    return n * 2 + 32;
+}
+
+//打开/关闭文件: FileDesc, 两个扇区缓冲区与文件名等小对象
+static uint OpenClosePattern(uint n, uint* fails)
+{
+    uint i = 0;
+    
+    for(i=0; i<n; i++)
+    {
+        void* fd = BMalloc(600);
+        void* name = BMalloc(32);
+        void* cache = BMalloc(512);
+        void* entry = BMalloc(512);
+        
+        *fails += !fd + !name + !cache + !entry;
+        
+        BFree(entry);
+        BFree(name);
+        BFree(cache);
+        BFree(fd);
+    }
+    
+    return n * 8;
+}
+
+//事件与等待队列节点: 大量生命周期很短的16字节对象, 与少量长期存在的任务等待节点交错
+static uint EventPattern(uint n, uint* fails)
+{
+    void* wait[8] = {0};
+    uint i = 0;
+    
+    for(i=0; i<n; i++)
+    {
+        uint k = i % 8;
+        void* evt = BMalloc(16);
+        
+        *fails += !evt;
+        
+        if( !(i % 4) )
+        {
+            BFree(wait[k]);
+            
+            *fails += !(wait[k] = BMalloc(24));
+        }
+        
+        BFree(evt);
+    }
+    
+    for(i=0; i<8; i++)
+    {
+        BFree(wait[i]);
+    }
+    
+    return n * 2 + n / 2;
+}
+
+//随机大小(16~2048)的对象随机释放, 保持LIVE_NUM个存活对象
+static uint RandomPattern(uint n, uint* fails)
+{
+    uint i = 0;
+    
+    srand(1);
+    
+    for(i=0; i<n; i++)
+    {
+        uint k = rand() % LIVE_NUM;
+        
+        BFree(gLive[k]);
+        
+        *fails += !(gLive[k] = BMalloc(16 << (rand() % 8)));
+    }
+    
+    for(i=0; i<LIVE_NUM; i++)
+    {
+        BFree(gLive[i]);
+        
+        gLive[i] = NULL;
+    }
+    
+    return n * 2;
+}
+
+//任意大小(1~6000)的对象, 约1/8超过2048字节走VMem
+static uint MixedPattern(uint n, uint* fails)
+{
+    uint i = 0;
+    
+    srand(2);
+    
+    for(i=0; i<n; i++)
+    {
+        uint k = rand() % LIVE_NUM;
+        uint size = (rand() % 8) ? (rand() % 2048 + 1) : (rand() % 6000 + 1);
+        
+        BFree(gLive[k]);
+        
+        *fails += !(gLive[k] = BMalloc(size));
+    }
+    
+    if( !gTiming )
+    {
+        printf("%-12s %9u%%\n", "fragment", MemFragment());
+    }
+    
+    for(i=0; i<LIVE_NUM; i++)
+    {
+        BFree(gLive[i]);
+        
+        gLive[i] = NULL;
+    }
+    
+    return n * 2;
+}
+
+static FILE* gTraceFile = NULL;
+
+//重放轨迹文件, 编号超出TRACE_NUM的行被忽略
+static uint TracePattern(uint n, uint* fails)
+{
+    uint ret = 0;
+    uint id = 0;
+    uint size = 0;
+    char op = 0;
+    
+    rewind(gTraceFile);
+    
+    while( fscanf(gTraceFile, " %c %u", &op, &id) == 2 )
+    {
+        if( (op == 'm') && (fscanf(gTraceFile, "%u", &size) == 1) && (id < TRACE_NUM) )
+        {
+            BFree(gTrace[id]);
+            
+            *fails += !(gTrace[id] = BMalloc(size));
+            
+            ret += 2;
+        }
+        else if( (op == 'f') && (id < TRACE_NUM) )
+        {
+            BFree(gTrace[id]);
+            
+            gTrace[id] = NULL;
+            
+            ret++;
+        }
+    }
+    
+    for(id=0; id<TRACE_NUM; id++)
+    {
+        BFree(gTrace[id]);
+        
+        gTrace[id] = NULL;
+    }
+    
+    return ret ? ret : 1;
+}
+
+static void Fill(FuzzObj* obj)
+{
+    uint i = 0;
+    
+    for(i=0; i<obj->size; i++)
+    {
+        obj->ptr[i] = (byte)(obj->seed + i);
+    }
+}
+
+//返回内容被破坏的字节数, 只检查前len个字节
+static uint Check(FuzzObj* obj, uint len)
+{
+    uint ret = 0;
+    uint i = 0;
+    
+    for(i=0; i<len; i++)
+    {
+        ret += (obj->ptr[i] != (byte)(obj->seed + i));
+    }
+    
+    return ret;
+}
+
+//地址必须落在堆内, 对齐且不越界
+static uint BadPtr(void* ptr, uint size, uint align)
+{
+    byte* p = (byte*)ptr;
+    
+    return (p < gHeap) || (p + size > gHeap + HEAP_SIZE) || ((uintptr_t)p & (align - 1));
+}
+
+static uint FuzzSize()
+{
+    uint ret = rand() % 4;
+    
+    if( ret == 0 )
+    {
+        ret = rand() % 64 + 1;
+    }
+    else if( ret == 3 )
+    {
+        ret = rand() % 8192 + 1;
+    }
+    else
+    {
+        ret = rand() % 2048 + 1;
+    }
+    
+    return ret;
+}
+
+//随机混合Malloc/MallocAligned/Calloc/Realloc/Free, 每个对象填满可校验的内容
+//同时释放对象内部的指针, 堆外的指针和NULL, 这些非法操作必须被忽略
+static uint FuzzPattern(uint n)
+{
+    uint ret = 0;
+    uint i = 0;
+    MemStat stat = {0};
+    
+    srand(3);
+    
+    for(i=0; i<n; i++)
+    {
+        FuzzObj* obj = &gFuzz[rand() % FUZZ_NUM];
+        uint op = rand() % 8;
+        
+        if( obj->ptr && (op < 3) )
+        {
+            ret += Check(obj, obj->size);
+            
+            if( op == 0 )
+            {
+                Free(obj->ptr + 8);
+            }
+            
+            Free(obj->ptr);
+            
+            if( op == 1 )
+            {
+                Free(gLive);
+                Free(NULL);
+            }
+            
+            obj->ptr = NULL;
+        }
+        else if( obj->ptr && (op < 5) )
+        {
+            uint size = FuzzSize();
+            byte* p = Realloc(obj->ptr, size);
+            
+            if( p )
+            {
+                ret += BadPtr(p, size, 4);
+                
+                obj->ptr = p;
+                
+                ret += Check(obj, Min(obj->size, size));
+                
+                obj->size = size;
+                
+                Fill(obj);
+            }
+            else
+            {
+                ret += Check(obj, obj->size);
+            }
+        }
+        else if( !obj->ptr )
+        {
+            uint size = FuzzSize();
+            uint align = 1 << (rand() % 13);
+            uint j = 0;
+            
+            if( op == 5 )
+            {
+                obj->ptr = MallocAligned(size, align);
+            }
+            else if( op == 6 )
+            {
+                align = 4;
+                obj->ptr = Calloc(1, size);
+                
+                for(j=0; obj->ptr && (j<size); j++)
+                {
+                    ret += !!obj->ptr[j];
+                }
+            }
+            else
+            {
+                align = 4;
+                obj->ptr = Malloc(size);
+            }
+            
+            if( obj->ptr )
+            {
+                ret += BadPtr(obj->ptr, size, align);
+                
+                obj->size = size;
+                obj->seed = (byte)rand();
+                
+                Fill(obj);
+            }
+        }
+    }
+    
+    for(i=0; i<FUZZ_NUM; i++)
+    {
+        if( gFuzz[i].ptr )
+        {
+            ret += Check(&gFuzz[i], gFuzz[i].size);
+            
+            Free(gFuzz[i].ptr);
+            
+            gFuzz[i].ptr = NULL;
+        }
+    }
+    
+    MemGetStat(&stat);
+    
+    ret += !!stat.used;
+    
+    printf("%-12s %10u ops %8u corrupt %8u left\n", "fuzz", n, ret, stat.used);
+    
+    return ret;
+}
+
+int main(int argc, char* argv[])
+{
+    uint n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    MemStat stat = {0};
+    
+    MemModInit(gHeap, sizeof(gHeap));
+    
+    Run("sector", SectorPattern, n);
+    Run("open-close", OpenClosePattern, n / 4);
+    Run("event", EventPattern, n);
+    Run("random", RandomPattern, n);
+    Run("mixed", MixedPattern, n);
+    
+    if( (argc > 2) && (gTraceFile = fopen(argv[2], "r")) )
+    {
+        Run("trace", TracePattern, 0);
+        
+        fclose(gTraceFile);
+    }
+    
+    MemGetStat(&stat);
+    
+    printf("%-12s %10u of %u bytes\n", "peak", stat.peak, stat.total);
+    
+    return !!FuzzPattern(n / 4);
+}
@@ -3,222 +3,1213 @@
 #include "utility.h"
 #include "list.h"
 
-#define FM_ALLOC_SIZE    32
-#define FM_NODE_SIZE     sizeof(FMemNode)
+#define SM_MAX_SIZE      SM_CLASS_SIZE(SM_CLASS_NUM - 1)
+#define SM_PAGE_SIZE     0x1000                         //每个slab页4KB
+#define VM_MAGIC         0x564D454D                     //"VMEM"
+#define VM_ALIGN         8
+#define VM_USED          1                              //块大小的最低位: 已分配
 #define VM_HEAD_SIZE     sizeof(VMemHead)
+#define VM_TAIL_SIZE     sizeof(uint)
+#define VM_MIN_SIZE      VMemAlign(VM_HEAD_SIZE + sizeof(ListNode) + VM_TAIL_SIZE)
+#define VMemAlign(n)     (((n) + VM_ALIGN - 1) & ~(VM_ALIGN - 1))
+#define VM_SL_SHIFT      3                              //每一级再等分为8个链表
+#define VM_SL_NUM        (1 << VM_SL_SHIFT)
+#define VM_FL_SHIFT      (VM_SL_SHIFT + 3)              //3为VM_ALIGN的位数
+#define VM_SMALL_SIZE    (1 << VM_FL_SHIFT)             //64字节以下按8字节线性划分
+#define VM_FL_NUM        (32 - VM_FL_SHIFT + 1)
+#define VM_MAX_SIZE      0x80000000
+#define VM_AREA_SIZE     VMemAlign(sizeof(VMemArea) + VM_TAIL_SIZE)    //区域描述符及其后的起始哨兵
+#define VM_GROW_SIZE     0x10000                        //每次至少扩展64KB
+#define AR_CHUNK_SIZE    1024                           //arena每次从堆中申请1KB
+#define AR_FREE          0x80000000                     //对象头部cls的最高位: 已释放
+#define AR_LARGE         AR_CLASS_NUM                   //大对象的cls, 头部之前还有挂入large链表的节点
+#define MC_BATCH         8                              //任务缓存每次从slab取回或归还的单元数
+#define MC_MAX           32                             //任务缓存每类最多保留的单元数
+#define MC_MAX_SIZE      SM_CLASS_SIZE(MC_CLASS_NUM - 1)
 
-typedef byte(FMemUnit)[FM_ALLOC_SIZE];  //内存分配单元大小是FM_ALLOC_SIZE即32bytes
-typedef union _FMemNode  FMemNode;	    //内存管理单元的别名 
+//slab页描述符, 与页本身分开存放, 页内全部用作分配单元
+typedef struct
+{
+    ListNode head;      //空闲页链表或所属大小类的部分空闲页链表
+    void* free;         //已释放分配单元组成的单向链表
+    ushort next;        //从未分配过的第一个分配单元的偏移, 用于按需切分
+    ushort inuse;       //已分配的单元数
+    ushort cls;         //大小类, SM_CLASS_NUM表示空闲页
+    ushort cnt;         //页内分配单元总数
+} SlabPage;
+
+typedef struct
+{
+    SlabPage* desc;     //页描述符数组
+    byte* base;         //第一个slab页的起始地址
+    uint max;           //slab页数
+    List pages;         //空闲页
+    List partial[SM_CLASS_NUM];    //每个大小类中还有空闲单元的页
+} SlabList;
+
+
+//边界标记: 每块的头部和尾部都存放块大小, 释放时可以直接找到前后相邻的块
+//空闲块的ListNode存放在头部之后, 已分配块的这部分空间交给用户
+typedef struct
+{
+    uint size;          //整块字节数(含头部和尾部标记), 最低位为VM_USED
+    uint check;         //VM_MAGIC ^ 块地址 ^ size, 用于识别非法指针和重复释放
+} VMemHead;
+
+//一段连续的VMem内存: 第一个块之前是标记为已分配的尾部哨兵, 最后一个块之后是已分配的头部哨兵
+//合并相邻块时遇到哨兵即停止, 不会越过区域边界
+typedef struct
+{
+    ListNode head;
+    byte* mem;          //区域原始地址, 归还时使用
+    uint size;          //区域原始字节数
+    byte* begin;        //第一个块
+    byte* end;          //结尾哨兵
+} VMemArea;
+
+//两级分箱(TLSF): 第一级按2的幂划分, 第二级将每个区间等分; 位图记录哪些链表非空
+typedef struct
+{
+    List areas;
+    VMemArea* first;    //MemModInit给出的区域, 不归还
+    uint freeBytes;
+    uint flBitmap;
+    uint slBitmap[VM_FL_NUM];
+    List free[VM_FL_NUM][VM_SL_NUM];
+} VMemList;
+
+//arena对象头部
+typedef struct
+{
+    Arena* arena;
+    uint cls;
+} ArenaHead;
+
+
+static SlabList gSlabList = {0};
+static VMemList gVMemList = {0};
+static MemGrowFunc gMemGrow = NULL;
+static MemShrinkFunc gMemShrink = NULL;
+static MemStat gMemStat = {0};
+static MemLockFunc gMemLock = NULL;
+static MemLockFunc gMemUnlock = NULL;
+static MemCache* gMemCache = NULL;
+static uint gCacheNum = 0;
+static const volatile uint* gCacheSlot = NULL;
+
+//cls为slab大小类, SM_CLASS_NUM表示VMem
+static void MemUse(uint cls, uint size)
+{
+    gMemStat.used += size;
+    gMemStat.peak = Max(gMemStat.peak, gMemStat.used);
+    gMemStat.live[cls] += size;
+}
+
+static void MemUnuse(uint cls, uint size)
+{
+    gMemStat.used -= size;
+    gMemStat.live[cls] -= size;
+}
+
+//mem开头存放页描述符, 之后是slab页; 页在各大小类之间按需分配, 全部单元释放后归还
+static void SlabInit(byte* mem, uint size)
+{
+    uint i = 0;
+    
+    uint end = ((uint)mem + size) & ~(SM_PAGE_SIZE - 1);   //slab页按页对齐, 单元地址按单元大小对齐
+    
+    gSlabList.max = (end > (uint)mem) ? (end - (uint)mem) / (SM_PAGE_SIZE + sizeof(SlabPage)) : 0;
+    gSlabList.desc = (SlabPage*)mem;
+    gSlabList.base = (byte*)(end - gSlabList.max * SM_PAGE_SIZE);
+    
+    List_Init(&gSlabList.pages);
+    
+    for(i=0; i<SM_CLASS_NUM; i++)
+    {
+        List_Init(gSlabList.partial + i);
+    }
+    
+    for(i=0; i<gSlabList.max; i++)
+    {
+        SlabPage* page = AddrOff(gSlabList.desc, i);
+        
+        page->cls = SM_CLASS_NUM;
+        
+        List_AddTail(&gSlabList.pages, (ListNode*)page);
+    }
+}
+
+//size所属的大小类, 超出最大类时返回SM_CLASS_NUM
+static uint SlabClass(uint size)
+{
+    uint ret = 0;
+    
+    while( (ret < SM_CLASS_NUM) && (size > SM_CLASS_SIZE(ret)) )
+    {
+        ret++;
+    }
+    
+    return ret;
+}
+
+static byte* PageAddr(SlabPage* page)
+{
+    return AddrOff(gSlabList.base, AddrIndex(page, gSlabList.desc) * SM_PAGE_SIZE);
+}
+
+static void* SlabAlloc(uint size)
+{
+    void* ret = NULL;
+    uint cls = SlabClass(size);
+    List* partial = gSlabList.partial + cls;
+    
+    if( (cls < SM_CLASS_NUM) && List_IsEmpty(partial) && !List_IsEmpty(&gSlabList.pages) )
+    {
+        SlabPage* page = (SlabPage*)gSlabList.pages.next;
+        
+        List_DelNode((ListNode*)page);
+        
+        page->free = NULL;
+        page->next = 0;
+        page->inuse = 0;
+        page->cls = cls;
+        page->cnt = SM_PAGE_SIZE >> (SM_MIN_SHIFT + cls);
+        
+        List_Add(partial, (ListNode*)page);
+    }
+    
+    if( (cls < SM_CLASS_NUM) && !List_IsEmpty(partial) )
+    {
+        SlabPage* page = (SlabPage*)partial->next;
+        
+        if( page->free )
+        {
+            ret = page->free;
+            page->free = *(void**)ret;
+        }
+        else
+        {
+            ret = AddrOff(PageAddr(page), page->next);
+            page->next += SM_CLASS_SIZE(cls);
+        }
+        
+        if( ++page->inuse == page->cnt )
+        {
+            List_DelNode((ListNode*)page);
+        }
+        
+        MemUse(cls, SM_CLASS_SIZE(cls));
+    }
+    
+    return ret;
+}
+
+//ptr是某个slab页中已分配单元的起始地址时返回所在页, 否则返回NULL
+static SlabPage* SlabUnitPage(void* ptr)
+{
+    SlabPage* ret = NULL;
+    uint off = (uint)ptr - (uint)gSlabList.base;
+    uint index = off / SM_PAGE_SIZE;
+    
+    if( ((uint)ptr >= (uint)gSlabList.base) && (index < gSlabList.max) )
+    {
+        SlabPage* page = AddrOff(gSlabList.desc, index);
+        uint unit = off % SM_PAGE_SIZE;
+        
+        if( (page->cls < SM_CLASS_NUM) && page->inuse && !(unit & (SM_CLASS_SIZE(page->cls) - 1)) && (unit < page->next) )
+        {
+            ret = page;
+        }
+    }
+    
+    return ret;
+}
+
+//返回释放的字节数
+static uint SlabFree(void* ptr)
+{
+    uint ret = 0;
+    SlabPage* page = SlabUnitPage(ptr);
+    
+    if( page )
+    {
+        ret = SM_CLASS_SIZE(page->cls);
+        
+        *(void**)ptr = page->free;
+        page->free = ptr;
+        
+        if( page->inuse-- == page->cnt )
+        {
+            List_Add(gSlabList.partial + page->cls, (ListNode*)page);
+        }
+        
+        if( !page->inuse && !IsEqual(page->head.next, page->head.prev) )
+        {   //整页空闲且该大小类还有其他部分空闲页时, 归还给其他大小类使用
+            List_DelNode((ListNode*)page);
+            
+            page->cls = SM_CLASS_NUM;
+            
+            List_Add(&gSlabList.pages, (ListNode*)page);
+        }
+    }
+    
+    return ret;
+}
+
+static uint BlockSize(VMemHead* block)
+{
+    return block->size & ~VM_USED;
+}
+
+static uint IsValidBlock(VMemHead* block)
+{
+    return (block->check == (VM_MAGIC ^ (uint)block ^ block->size)) &&
+           (*(uint*)AddrOff((byte*)block, BlockSize(block) - VM_TAIL_SIZE) == block->size);
+}
+
+static void SetBlock(VMemHead* block, uint size, uint used)
+{
+    block->size = size | used;
+    block->check = VM_MAGIC ^ (uint)block ^ block->size;
+    
+    *(uint*)AddrOff((byte*)block, size - VM_TAIL_SIZE) = block->size;
+}
+
+static ListNode* FreeNode(VMemHead* block)
+{
+    return (ListNode*)AddrOff(block, 1);
+}
+
+static VMemHead* NodeBlock(ListNode* node)
+{
+    return (VMemHead*)node - 1;
+}
+
+static void MapBin(uint size, uint* fl, uint* sl)
+{
+    if( size < VM_SMALL_SIZE )
+    {
+        *fl = 0;
+        *sl = size / (VM_SMALL_SIZE / VM_SL_NUM);
+    }
+    else
+    {
+        uint high = BitHigh(size);
+        
+        *fl = high - VM_FL_SHIFT + 1;
+        *sl = (size >> (high - VM_SL_SHIFT)) - VM_SL_NUM;
+    }
+}
+
+static void InsertBlock(VMemHead* block)
+{
+    uint fl = 0;
+    uint sl = 0;
+    
+    MapBin(BlockSize(block), &fl, &sl);
+    
+    List_Add(&gVMemList.free[fl][sl], FreeNode(block));
+    
+    gVMemList.slBitmap[fl] |= (1 << sl);
+    gVMemList.flBitmap |= (1 << fl);
+    gVMemList.freeBytes += BlockSize(block);
+}
+
+static void RemoveBlock(VMemHead* block)
+{
+    uint fl = 0;
+    uint sl = 0;
+    
+    MapBin(BlockSize(block), &fl, &sl);
+    
+    List_DelNode(FreeNode(block));
+    
+    if( List_IsEmpty(&gVMemList.free[fl][sl]) )
+    {
+        gVMemList.slBitmap[fl] &= ~(1 << sl);
+        
+        if( !gVMemList.slBitmap[fl] )
+        {
+            gVMemList.flBitmap &= ~(1 << fl);
+        }
+    }
+    
+    gVMemList.freeBytes -= BlockSize(block);
+}
+
+//向上取整到所在分箱的上界, 下一个分箱中任意一块都能满足size
+static uint RoundBin(uint size)
+{
+    uint ret = size;
+    
+    if( size >= VM_SMALL_SIZE )
+    {
+        ret += (1 << (BitHigh(size) - VM_SL_SHIFT)) - 1;
+    }
+    
+    return ret;
+}
+
+//请求大小先向上取整, 找到的链表中任意一块都能满足, 无需遍历
+static VMemHead* FindBlock(uint size)
+{
+    VMemHead* ret = NULL;
+    uint fl = 0;
+    uint sl = 0;
+    uint map = 0;
+    
+    MapBin(RoundBin(size), &fl, &sl);
+    
+    map = gVMemList.slBitmap[fl] & (~0U << sl);
+    
+    if( !map )
+    {
+        uint flMap = (fl + 1 < VM_FL_NUM) ? (gVMemList.flBitmap & (~0U << (fl + 1))) : 0;
+        
+        if( flMap )
+        {
+            fl = BitLow(flMap);
+            map = gVMemList.slBitmap[fl];
+        }
+    }
+    
+    if( map )
+    {
+        sl = BitLow(map);
+        ret = NodeBlock(gVMemList.free[fl][sl].next);
+    }
+    
+    return ret;
+}
+
+static void VMemInit()
+{
+    uint i = 0;
+    uint j = 0;
+    
+    List_Init(&gVMemList.areas);
+    
+    gVMemList.first = NULL;
+    gVMemList.freeBytes = 0;
+    gVMemList.flBitmap = 0;
+    
+    for(i=0; i<VM_FL_NUM; i++)
+    {
+        gVMemList.slBitmap[i] = 0;
+        
+        for(j=0; j<VM_SL_NUM; j++)
+        {
+            List_Init(&gVMemList.free[i][j]);
+        }
+    }
+}
+
+static VMemArea* VMemAddArea(byte* mem, uint size)
+{
+    VMemArea* ret = (VMemArea*)VMemAlign((uint)mem);
+    uint avail = (size - ((byte*)ret - mem)) & ~(VM_ALIGN - 1);
+    
+    if( (size > (uint)((byte*)ret - mem)) && (avail >= VM_AREA_SIZE + VM_MIN_SIZE + VM_HEAD_SIZE) )
+    {
+        VMemHead* end = NULL;
+        
+        ret->mem = mem;
+        ret->size = size;
+        ret->begin = AddrOff((byte*)ret, VM_AREA_SIZE);
+        ret->end = AddrOff((byte*)ret, avail - VM_HEAD_SIZE);
+        
+        *((uint*)ret->begin - 1) = VM_USED;
+        
+        end = (VMemHead*)ret->end;
+        end->size = VM_USED;
+        end->check = 0;
+        
+        SetBlock((VMemHead*)ret->begin, ret->end - ret->begin, 0);
+        
+        InsertBlock((VMemHead*)ret->begin);
+        
+        List_Add(&gVMemList.areas, (ListNode*)ret);
+        
+        gMemStat.areas++;
+    }
+    else
+    {
+        ret = NULL;
+    }
+    
+    return ret;
+}
+
+static VMemArea* FindArea(void* ptr)
+{
+    VMemArea* ret = NULL;
+    ListNode* pos = NULL;
+    
+    List_ForEach(&gVMemList.areas, pos)
+    {
+        VMemArea* area = (VMemArea*)pos;
+        
+        if( ((byte*)ptr >= area->begin) && ((byte*)ptr < area->end) )
+        {
+            ret = area;
+            break;
+        }
+    }
+    
+    return ret;
+}
+
+static uint AllocSize(uint size)
+{
+    return Max(VMemAlign(size + VM_HEAD_SIZE + VM_TAIL_SIZE), VM_MIN_SIZE);
+}
+
+//block不在空闲链表中, 大小为bsize; 只保留alloc字节, 剩余部分足够大时切分为空闲块并与后面的空闲块合并
+//返回block保留的字节数
+static uint TrimBlock(VMemHead* block, uint bsize, uint alloc)
+{
+    uint ret = bsize;
+    
+    if( (bsize - alloc) >= VM_MIN_SIZE )
+    {
+        VMemHead* rest = (VMemHead*)AddrOff((byte*)block, alloc);
+        VMemHead* next = (VMemHead*)AddrOff((byte*)block, bsize);
+        uint rsize = bsize - alloc;
+        
+        if( !(next->size & VM_USED) )
+        {
+            RemoveBlock(next);
+            
+            rsize += BlockSize(next);
+        }
+        
+        SetBlock(rest, rsize, 0);
+        
+        InsertBlock(rest);
+        
+        ret = alloc;
+    }
+    
+    return ret;
+}
+
+//从位图找到合适的分箱, 剩余部分足够大时切分出新的空闲块放回对应分箱
+static void* VMemAlloc(uint size)
+{
+    VMemHead* ret = NULL;
+    uint alloc = AllocSize(size);
+    
+    if( size < VM_MAX_SIZE )
+    {
+        ret = FindBlock(alloc);
+    }
+    
+    if( ret )
+    {
+        uint bsize = BlockSize(ret);
+        
+        RemoveBlock(ret);
+        
+        bsize = TrimBlock(ret, bsize, alloc);
+        
+        SetBlock(ret, bsize, VM_USED);
+        
+        MemUse(SM_CLASS_NUM, bsize);
+    }
+    
+    return ret ? AddrOff(ret, 1) : NULL;
+}
+
+//多取align + VM_MIN_SIZE字节, 对齐位置之前的部分切分为空闲块, 之后的部分由TrimBlock处理
+static void* VMemAllocAligned(uint size, uint align)
+{
+    VMemHead* ret = NULL;
+    uint alloc = AllocSize(size);
+    
+    if( (size < VM_MAX_SIZE) && (align < VM_MAX_SIZE) )
+    {
+        ret = FindBlock(alloc + align + VM_MIN_SIZE);
+    }
+    
+    if( ret )
+    {
+        uint bsize = BlockSize(ret);
+        uint data = (uint)(ret + 1);
+        uint aligned = (data + align - 1) & ~(align - 1);
+        
+        RemoveBlock(ret);
+        
+        while( (aligned > data) && (aligned - data < VM_MIN_SIZE) )
+        {
+            aligned += align;
+        }
+        
+        if( aligned > data )
+        {
+            SetBlock(ret, aligned - data, 0);
+            
+            InsertBlock(ret);
+            
+            bsize -= aligned - data;
+            ret = (VMemHead*)aligned - 1;
+        }
+        
+        bsize = TrimBlock(ret, bsize, alloc);
+        
+        SetBlock(ret, bsize, VM_USED);
+        
+        MemUse(SM_CLASS_NUM, bsize);
+    }
+    
+    return ret ? AddrOff(ret, 1) : NULL;
+}
+
+//由头部校验值识别合法的已分配块, 再通过边界标记与前后空闲块合并, 与已分配块的数量无关
+//扩展出的区域整体空闲且其他区域还有同样多的空闲空间时归还, 避免在边界上反复扩展和归还
+static VMemArea* UsedBlockArea(VMemHead* block)
+{
+    VMemArea* ret = !((uint)block & (VM_ALIGN - 1)) ? FindArea(block) : NULL;
+    
+    if( !(ret && (block->size & VM_USED) && (BlockSize(block) <= (uint)(ret->end - (byte*)block)) && IsValidBlock(block)) )
+    {
+        ret = NULL;
+    }
+    
+    return ret;
+}
+
+static uint VMemFree(void* ptr)
+{
+    uint ret = 0;
+    VMemHead* block = (VMemHead*)ptr - 1;
+    VMemArea* area = UsedBlockArea(block);
+    
+    if( area )
+    {
+        uint size = BlockSize(block);
+        VMemHead* next = (VMemHead*)AddrOff((byte*)block, size);
+        uint prevSize = *((uint*)block - 1);
+        
+        ret = size;
+        
+        if( !(next->size & VM_USED) )
+        {
+            RemoveBlock(next);
+            
+            size += BlockSize(next);
+        }
+        
+        if( !(prevSize & VM_USED) )
+        {
+            VMemHead* prev = (VMemHead*)((byte*)block - prevSize);
+            
+            RemoveBlock(prev);
+            
+            block->check = 0;       //被合并的头部失效, 防止重复释放
+            block = prev;
+            size += prevSize;
+        }
+        
+        if( (area != gVMemList.first) && gMemShrink && (size == (uint)(area->end - area->begin)) && (gVMemList.freeBytes >= size) )
+        {
+            List_DelNode((ListNode*)area);
+            
+            gMemStat.total -= area->size;
+            gMemStat.areas--;
+            
+            gMemShrink(area->mem, area->size);
+        }
+        else
+        {
+            SetBlock(block, size, 0);
+            
+            InsertBlock(block);
+        }
+    }
+    
+    return ret;
+}
+
+//原地调整已分配块的大小: 缩小时切出尾部, 增大时合并后面的空闲块; 无法原地完成时返回0
+static uint VMemResize(void* ptr, uint size)
+{
+    uint ret = 0;
+    VMemHead* block = (VMemHead*)ptr - 1;
+    uint alloc = AllocSize(size);
+    uint bsize = BlockSize(block);
+    VMemHead* next = (VMemHead*)AddrOff((byte*)block, bsize);
+    
+    if( alloc <= bsize )
+    {
+        ret = 1;
+    }
+    else if( !(next->size & VM_USED) && (alloc <= bsize + BlockSize(next)) )
+    {
+        RemoveBlock(next);
+        
+        ret = 1;
+    }
+    
+    if( ret )
+    {
+        uint total = (alloc <= bsize) ? bsize : (bsize + BlockSize(next));
+        
+        MemUnuse(SM_CLASS_NUM, bsize);
+        
+        if( alloc > bsize )
+        {
+            next->check = 0;
+        }
+        
+        total = TrimBlock(block, total, alloc);
+        
+        SetBlock(block, total, VM_USED);
+        
+        MemUse(SM_CLASS_NUM, total);
+    }
+    
+    return ret;
+}
 
-union _FMemNode			//管理单元4bytes 注意是union尽量少地使用内存
+//向系统申请能容纳size字节请求的新区域
+static uint VMemGrow(uint size)
 {
-    FMemNode* next;		//管理单元间链表形式连接起来
-    FMemUnit* ptr;      //标记
-};
+    uint ret = 0;
+    
+    if( gMemGrow && (size < VM_MAX_SIZE) )
+    {
+        uint need = VM_AREA_SIZE + RoundBin(VMemAlign(size + VM_HEAD_SIZE + VM_TAIL_SIZE)) + VM_MIN_SIZE + VM_HEAD_SIZE + VM_ALIGN;
+        uint grow = Max(need, VM_GROW_SIZE);
+        byte* mem = gMemGrow(&grow);
+        
+        if( mem && (grow >= need) && VMemAddArea(mem, grow) )
+        {
+            gMemStat.total += grow;
+            
+            ret = 1;
+        }
+        else if( mem && gMemShrink )
+        {
+            gMemShrink(mem, grow);
+        }
+    }
+    
+    return ret;
+}
 
-typedef struct			
+//最大空闲块位于最高的非空分箱中
+static uint VMemLargest()
 {
-    FMemNode* node;	    //指向内存管理链表的头节点
-    FMemNode* nbase;    //内存管理单元起始地址
-    FMemUnit* ubase;    //内存分配单元起始地址
-    uint max;		    //记录还有多少内存分配单元可以用
-} FMemList;
-
+    uint ret = 0;
+    
+    if( gVMemList.flBitmap )
+    {
+        uint fl = BitHigh(gVMemList.flBitmap);
+        uint sl = BitHigh(gVMemList.slBitmap[fl]);
+        ListNode* pos = NULL;
+        
+        List_ForEach(&gVMemList.free[fl][sl], pos)
+        {
+            ret = Max(ret, BlockSize(NodeBlock(pos)));
+        }
+    }
+    
+    return ret;
+}
 
-typedef struct
+void MemModInit(byte* mem, uint size)
 {
-    ListNode head;      //ListNode双向链表节点
-    uint used;          //使用区域长度
-    uint free;          //空闲区域长度
-    byte* ptr;          //指向已用区域起始位置
-} VMemHead;
+    byte* smem = mem;
+    uint ssize = size / 2;
+    byte* vmem = AddrOff(smem, ssize);
+    uint vsize = size - ssize;
+    
+    MemSet((byte*)&gMemStat, sizeof(gMemStat), 0);
+    
+    gMemStat.total = size;
+    
+    SlabInit(smem, ssize);
+    VMemInit();
+    
+    gVMemList.first = VMemAddArea(vmem, vsize);
+}
 
+//堆用完时通过grow向系统申请新区域, 扩展出的区域整体空闲后通过shrink归还
+void MemSetGrow(MemGrowFunc grow, MemShrinkFunc shrink)
+{
+    gMemGrow = grow;
+    gMemShrink = shrink;
+}
 
-static FMemList gFMemList = {0};        //定长内存管理单元链表 --表头
-static List gVMemList = {0};
+//不超过SM_MAX_SIZE的请求由slab分配, slab页用完或更大的请求使用VMem, VMem不足时扩展堆
+static void* HeapAlloc(uint size)
+{
+    void* ret = NULL;
+    
+    if( size <= SM_MAX_SIZE )
+    {
+        ret = SlabAlloc(size);
+    }
+    
+    if( !ret ) 
+    {
+        ret = VMemAlloc(size);
+    }
+    
+    if( !ret && VMemGrow(size) )
+    {
+        ret = VMemAlloc(size);
+    }
+    
+    return ret;
+}
 
-//初始化内存管理,从mem中构建管理单元和分配单元
-static void FMemInit(byte* mem, uint size)
+static void HeapFree(void* ptr)
 {
-    FMemNode* p = NULL;
-    int i = 0;
-    uint max = 0;
+    SlabPage* page = SlabUnitPage(ptr);
+    uint cls = page ? page->cls : SM_CLASS_NUM;
+    uint size = page ? SlabFree(ptr) : VMemFree(ptr);
     
-    max = size / (FM_NODE_SIZE + FM_ALLOC_SIZE);
-    //gFMemList赋值--内存管理单元群殴起始位置和内存分配单元起始位置
-    gFMemList.max = max;
-    gFMemList.nbase = (FMemNode*)mem;
-    gFMemList.ubase = (FMemUnit*)((uint)mem + max * FM_NODE_SIZE);
-    gFMemList.node = (FMemNode*)mem;
+    MemUnuse(cls, size);
+}
+
+static void MemLock()
+{
+    if( gMemLock )
+    {
+        gMemLock();
+    }
+}
+
+static void MemUnlock()
+{
+    if( gMemUnlock )
+    {
+        gMemUnlock();
+    }
+}
+
+//多个任务共享同一个堆时(应用), 由lock/unlock保护堆的全局数据; 内核中关中断运行, 无需设置
+void MemSetLock(MemLockFunc lock, MemLockFunc unlock)
+{
+    gMemLock = lock;
+    gMemUnlock = unlock;
+}
+
+//cache为num个任务缓存组成的数组, *slot为当前任务使用的缓存下标
+void MemSetCache(MemCache* cache, uint num, const volatile uint* slot)
+{
+    uint i = 0;
+    uint j = 0;
     
-    p = gFMemList.node;
-    //从管理单元0~n-1，每个管理单元的next指针指向下一个管理单元
-    for(i=0; i<max-1; i++)
+    for(i=0; cache && (i<num); i++)
     {
-        FMemNode* current = (FMemNode*)AddrOff(p, i);
-        FMemNode* next = (FMemNode*)AddrOff(p, i+1);
-        
-        current->next = next;
+        for(j=0; j<MC_CLASS_NUM; j++)
+        {
+            cache[i].free[j] = NULL;
+            cache[i].cnt[j] = 0;
+        }
     }
-    //最后一个管理单元指向null
-    ((FMemNode*)AddrOff(p, i))->next = NULL;
+    
+    gMemCache = cache;
+    gCacheNum = num;
+    gCacheSlot = slot;
 }
 
-static void* FMemAlloc()
+static MemCache* CurrentCache()
 {
-    void* ret = NULL;
-    //gFMemList.node指向管理单元链表的第一个节点,将管理单元第一个节点分配出去
-    if( gFMemList.node )
+    MemCache* ret = NULL;
+    
+    if( gMemCache && (*gCacheSlot < gCacheNum) )
     {
-        //取出来的管理单元相对于nbase(管理单元头部)的编号是多少
-        FMemNode* alloc = gFMemList.node;
-        int index = AddrIndex(alloc, gFMemList.nbase);
-        //取出对应的内存分配单元
-        ret = AddrOff(gFMemList.ubase, index);
-        //更新链表的头节点为下一个相邻节点
-        gFMemList.node = alloc->next;
-        //标记内存管理单元指向分配单元,归还内存的时候可以验证一下
-        alloc->ptr = ret;
+        ret = gMemCache + *gCacheSlot;
     }
-    //返回值为分配单元地址
+    
     return ret;
 }
 
-//传入参数是分配单元的地址
-static int FMemFree(void* ptr)
+//缓存为空时加锁从slab批量取回MC_BATCH个单元
+static void* CacheAlloc(MemCache* cache, uint cls)
 {
-    int ret = 0;
+    void* ret = NULL;
     
-    if( ptr )
-    {   //取出来的分配单元相对于ubase的(分配单元头部)的编号是多少
-        uint index = AddrIndex((FMemUnit*)ptr, gFMemList.ubase);
-        //根据编号与全局nbase取出管理单元来
-        FMemNode* node = AddrOff(gFMemList.nbase, index);
-        //判断一下管理单元下标和ptr的值是否有问题
-        if( (index < gFMemList.max) && IsEqual(node->ptr, ptr) )
-        {   //将此node插入的链表头部
-            node->next = gFMemList.node;
+    if( !cache->free[cls] )
+    {
+        uint i = 0;
+        
+        MemLock();
+        
+        for(i=0; i<MC_BATCH; i++)
+        {
+            void* unit = SlabAlloc(SM_CLASS_SIZE(cls));
             
-            gFMemList.node = node;
+            if( !unit )
+            {
+                break;
+            }
             
-            ret = 1;
+            *(void**)unit = cache->free[cls];
+            cache->free[cls] = unit;
+            cache->cnt[cls]++;
         }
+        
+        MemUnlock();
+    }
+    
+    if( (ret = cache->free[cls]) )
+    {
+        cache->free[cls] = *(void**)ret;
+        cache->cnt[cls]--;
     }
     
     return ret;
 }
 
-static void VMemInit(byte* mem, uint size)
+//缓存超过MC_MAX个单元时加锁归还MC_BATCH个给slab
+static void CacheFree(MemCache* cache, uint cls, void* ptr)
+{
+    *(void**)ptr = cache->free[cls];
+    cache->free[cls] = ptr;
+    
+    if( ++cache->cnt[cls] > MC_MAX )
+    {
+        uint i = 0;
+        
+        MemLock();
+        
+        for(i=0; i<MC_BATCH; i++)
+        {
+            void* unit = cache->free[cls];
+            
+            cache->free[cls] = *(void**)unit;
+            cache->cnt[cls]--;
+            
+            HeapFree(unit);
+        }
+        
+        MemUnlock();
+    }
+}
+
+//小对象优先使用当前任务的缓存, 其余情况加锁后访问堆
+void* Malloc(uint size)
 {
-    List_Init((List*)&gVMemList);       //初始化一个双向链表节点,next和prev都指向gVMemList
-    VMemHead* head = (VMemHead*)mem;    //创建管理头
+    void* ret = NULL;
+    MemCache* cache = (gMemCache && (size <= MC_MAX_SIZE)) ? CurrentCache() : NULL;
+    
+    if( cache )
+    {
+        ret = CacheAlloc(cache, SlabClass(size));
+    }
     
-    head->used = 0;                     //已用区域初始化为0
-    head->free = size - VM_HEAD_SIZE;   //除了管理头都是空闲区域
-    head->ptr = AddrOff(head, 1);       //ptr指向userd的开头
+    if( !ret )
+    {
+        MemLock();
+        
+        ret = HeapAlloc(size);
+        
+        gMemStat.fails += !ret;
+        
+        MemUnlock();
+    }
     
-    List_AddTail(&gVMemList, (ListNode*)head);//插入到全局链表头
-} 
+    return ret;
+}
 
-static void* VMemAlloc(uint size)
+//缓存中的单元对slab而言仍是已分配的, 由任何任务释放都可以放入当前任务的缓存
+void Free(void* ptr)
 {
-    ListNode* pos = NULL;
-    VMemHead* ret = NULL;
-    uint alloc = size + VM_HEAD_SIZE;
-    //for(pos=(&gVMemList)->next; !IsEqual(&gVMemList, pos); pos=pos->next)
-    List_ForEach(&gVMemList, pos)
+    if( ptr )
     {
-        VMemHead* current = (VMemHead*)pos;
-        //满足需要的大小
-        if( current->free >= alloc )
-        {   //(uint)current->ptr + (current->used + current->free)当前管理节点的空闲区域的末尾
-            //然后再减去alloc 需要申请的内存大小，意味着从空闲内存尾部分割
-            byte* mem = (byte*)((uint)current->ptr + (current->used + current->free) - alloc);
-            
-            ret = (VMemHead*)mem;
-            ret->used = size;           //新的管理节点的used为申请的size大小内存
-            ret->free = 0;              //free成员为0
-            ret->ptr = AddrOff(ret, 1); //ptr指针指向used起始位置即 管理头后面
-            
-            current->free -= alloc;     //原先的节点减去被划分的大小
+        MemCache* cache = gMemCache ? CurrentCache() : NULL;
+        SlabPage* page = cache ? SlabUnitPage(ptr) : NULL;
+        
+        if( page && (page->cls < MC_CLASS_NUM) )
+        {
+            CacheFree(cache, page->cls, ptr);
+        }
+        else
+        {
+            MemLock();
             
-            List_AddAfter((ListNode*)current, (ListNode*)ret);//中部节点插入
+            HeapFree(ptr);
             
-            break;
+            MemUnlock();
         }
     }
-    //返回used地址即管理头后面的地址
-    return ret ? ret->ptr : NULL;
 }
 
-static int VMemFree(void* ptr)
+//align为2的幂; slab单元按单元大小对齐, 不超过SM_MAX_SIZE的对齐要求由slab满足, 其余由VMem切分对齐
+void* MallocAligned(uint size, uint align)
 {
-    int ret = 0;
+    void* ret = NULL;
     
-    if( ptr )
+    if( align && !(align & (align - 1)) )
     {
-        ListNode* pos = NULL;
-        //遍历管理链表
-        List_ForEach(&gVMemList, pos)
+        if( align <= VM_ALIGN )
+        {
+            ret = Malloc(size);
+        }
+        else
         {
-            VMemHead* current = (VMemHead*)pos;
-            //used地址相同
-            if( IsEqual(current->ptr, ptr) )
+            MemLock();
+            
+            if( Max(size, align) <= SM_MAX_SIZE )
             {
-                VMemHead* prev = (VMemHead*)(current->head.prev);
-                
-                prev->free += current->used + current->free + VM_HEAD_SIZE;
-                //双向链表删除节点，注意prev节点要么是VMemAlloc(cur)之后再进行VMemAlloc(prev)
-                //要么prev节点是最初的节点
-                List_DelNode((ListNode*)current);
-                
-                ret = 1;
-                
-                break;
+                ret = SlabAlloc(Max(size, align));
+            }
+            
+            if( !ret )
+            {
+                ret = VMemAllocAligned(size, align);
             }
+            
+            if( !ret && VMemGrow(size + align + VM_MIN_SIZE) )
+            {
+                ret = VMemAllocAligned(size, align);
+            }
+            
+            gMemStat.fails += !ret;
+            
+            MemUnlock();
         }
     }
     
     return ret;
 }
 
-void MemModInit(byte* mem, uint size)
+//slab单元在原单元放得下时不移动; VMem块尽量原地缩小或与后面的空闲块合并, 否则分配新块并复制
+void* Realloc(void* ptr, uint size)
+{
+    void* ret = NULL;
+    
+    if( !ptr )
+    {
+        ret = Malloc(size);
+    }
+    else if( !size )
+    {
+        Free(ptr);
+    }
+    else
+    {
+        uint usable = 0;
+        SlabPage* page = NULL;
+        
+        MemLock();
+        
+        if( (page = SlabUnitPage(ptr)) )
+        {
+            usable = SM_CLASS_SIZE(page->cls);
+            ret = (size <= usable) ? ptr : NULL;
+        }
+        else if( UsedBlockArea((VMemHead*)ptr - 1) )
+        {
+            usable = BlockSize((VMemHead*)ptr - 1) - VM_HEAD_SIZE - VM_TAIL_SIZE;
+            ret = ((size < VM_MAX_SIZE) && VMemResize(ptr, size)) ? ptr : NULL;
+        }
+        
+        MemUnlock();
+        
+        if( !ret && usable && (ret = Malloc(size)) )
+        {
+            MemCpy(ret, ptr, Min(usable, size));
+            
+            Free(ptr);
+        }
+    }
+    
+    return ret;
+}
+
+//按4字节清零, 剩余的字节逐个清零
+static void MemZero(byte* mem, uint n)
 {
-    byte* fmem = mem;
-    uint fsize = size / 2;
-    byte* vmem = AddrOff(fmem, fsize);
-    uint vsize = size - fsize;
+    uint cnt = n / sizeof(uint);
+    byte* tail = AddrOff(mem, cnt * sizeof(uint));
+    uint i = 0;
     
-    FMemInit(fmem, fsize);
-    VMemInit(vmem, vsize);
+    asm volatile("cld; rep stosl" : "+D"(mem), "+c"(cnt) : "a"(0) : "memory");
+    
+    for(i=0; i<n%sizeof(uint); i++)
+    {
+        tail[i] = 0;
+    }
 }
 
-void* Malloc(uint size)
+void* Calloc(uint num, uint size)
 {
     void* ret = NULL;
     
-    if( size <= FM_ALLOC_SIZE )
+    if( !num || (size <= (uint)-1 / num) )
     {
-        ret = FMemAlloc();
+        ret = Malloc(num * size);
     }
     
-    if( !ret ) 
+    if( ret )
     {
-        ret = VMemAlloc(size);
+        MemZero(ret, num * size);
     }
     
     return ret;
 }
 
-void Free(void* ptr)
+void MemGetStat(MemStat* stat)
 {
-    if( ptr )
+    if( stat )
+    {
+        MemLock();
+        
+        *stat = gMemStat;
+        
+        stat->largest = VMemLargest();
+        stat->fragment = MemFragment();
+        
+        MemUnlock();
+    }
+}
+
+//VMem碎片率(百分比): 不在最大空闲块中的空闲字节所占比例, 0表示空闲空间完全连续
+uint MemFragment()
+{
+    uint ret = 0;
+    uint total = gVMemList.freeBytes;
+    uint frag = total - VMemLargest();
+    
+    while( total > 0x1000000 )  //避免乘100溢出
+    {
+        total >>= 1;
+        frag >>= 1;
+    }
+    
+    if( total )
+    {
+        ret = frag * 100 / total;
+    }
+    
+    return ret;
+}
+
+void ArenaInit(Arena* arena)
+{
+    uint i = 0;
+    
+    List_Init(&arena->chunks);
+    List_Init(&arena->large);
+    
+    arena->cur = NULL;
+    arena->left = 0;
+    
+    for(i=0; i<AR_CLASS_NUM; i++)
     {
-        if( !FMemFree(ptr) )
+        arena->free[i] = NULL;
+    }
+}
+
+//优先重用本arena中释放的同类对象, 否则从当前块切分, 当前块不够时再从堆中申请新块; 大对象单独从堆中申请
+void* ArenaAlloc(Arena* arena, uint size)
+{
+    ArenaHead* ret = NULL;
+    uint cls = SlabClass(size + sizeof(ArenaHead));
+    uint unit = SM_CLASS_SIZE(cls);
+    
+    if( arena && (cls >= AR_CLASS_NUM) && (size <= size + sizeof(ListNode) + sizeof(ArenaHead)) )
+    {
+        ListNode* node = Malloc(sizeof(ListNode) + sizeof(ArenaHead) + size);
+        
+        if( node )
+        {
+            List_Add(&arena->large, node);
+            
+            ret = (ArenaHead*)(node + 1);
+            cls = AR_LARGE;
+        }
+    }
+    else if( arena )
+    {
+        if( arena->free[cls] )
         {
-            VMemFree(ptr);
+            ret = arena->free[cls];
+            arena->free[cls] = *(void**)(ret + 1);
+        }
+        else
+        {
+            if( arena->left < unit )
+            {
+                ListNode* chunk = Malloc(AR_CHUNK_SIZE);
+                
+                if( chunk )
+                {
+                    List_Add(&arena->chunks, chunk);
+                    
+                    arena->cur = (byte*)VMemAlign((uint)(chunk + 1));
+                    arena->left = AR_CHUNK_SIZE - (arena->cur - (byte*)chunk);
+                }
+            }
+            
+            if( arena->left >= unit )
+            {
+                ret = (ArenaHead*)arena->cur;
+                
+                arena->cur += unit;
+                arena->left -= unit;
+            }
         }
     }
+    
+    if( ret )
+    {
+        ret->arena = arena;
+        ret->cls = cls;
+    }
+    
+    return ret ? (ret + 1) : NULL;
 }
 
+//对象回到所属arena的空闲链表, 与调用者是哪个arena无关
+void ArenaFree(void* ptr)
+{
+    ArenaHead* head = (ArenaHead*)ptr - 1;
+    
+    if( ptr && (head->cls == AR_LARGE) )
+    {
+        ListNode* node = (ListNode*)head - 1;
+        
+        List_DelNode(node);
+        
+        Free(node);
+    }
+    else if( ptr && (head->cls < AR_CLASS_NUM) )
+    {
+        Arena* arena = head->arena;
+        
+        *(void**)ptr = arena->free[head->cls];
+        arena->free[head->cls] = head;
+        
+        head->cls |= AR_FREE;
+    }
+}
 
+//归还全部块和大对象, 其中的对象随之失效
+void ArenaRelease(Arena* arena)
+{
+    while( !List_IsEmpty(&arena->chunks) )
+    {
+        ListNode* chunk = arena->chunks.next;
+        
+        List_DelNode(chunk);
+        
+        Free(chunk);
+    }
+    
+    while( !List_IsEmpty(&arena->large) )
+    {
+        ListNode* node = arena->large.next;
+        
+        List_DelNode(node);
+        
+        Free(node);
+    }
+    
+    ArenaInit(arena);
+}
@@ -3,9 +3,65 @@
 #define MEMORY_H
 
 #include "type.h"
+#include "list.h"
+
+#define SM_MIN_SHIFT    4                   //最小的分配单元16字节
+#define SM_CLASS_NUM    8                   //slab按16, 32 ... 2048字节分为8类
+#define SM_CLASS_SIZE(c) (1 << (SM_MIN_SHIFT + (c)))    //slab第c类的单元大小
+#define MS_CLASS_NUM    (SM_CLASS_NUM + 1)  //统计时slab各大小类之后是VMem
+#define AR_CLASS_NUM    5                   //arena对象按16, 32 ... 256字节分为5类
+#define MC_CLASS_NUM    4                   //任务缓存16, 32, 64, 128字节的slab单元
+
+typedef void* (*MemGrowFunc)(uint* size);          //size传入最少需要的字节数, 传出实际得到的字节数
+typedef void (*MemShrinkFunc)(void* mem, uint size);
+typedef void (*MemLockFunc)();
+
+typedef struct
+{
+    uint total;         //堆总字节数, 包含扩展出的区域
+    uint used;          //已分配的字节数, 按实际占用的分配单元或块计算, 含任务缓存中的单元
+    uint peak;          //used的最高水位
+    uint areas;         //VMem区域数
+    uint fails;         //失败的分配次数
+    uint largest;       //最大空闲VMem块的字节数
+    uint fragment;      //VMem碎片率(百分比), 见MemFragment
+    uint live[MS_CLASS_NUM];    //各大小类已分配的字节数
+} MemStat;
+
+//arena: 从堆中按块申请内存, 对象在块内顺序切分, 释放的对象按大小类留在arena内重用
+//超过256字节的对象直接从堆中申请并挂入large链表; ArenaRelease一次归还全部块和大对象, 无需逐个释放其中的对象
+typedef struct
+{
+    List chunks;
+    List large;
+    byte* cur;          //当前块中未切分部分的起始地址
+    uint left;          //当前块中未切分的字节数
+    void* free[AR_CLASS_NUM];
+} Arena;
 
 void MemModInit(byte* mem, uint size);
 void* Malloc(uint size);
 void Free(void* ptr);
+void* MallocAligned(uint size, uint align);
+void* Realloc(void* ptr, uint size);
+void* Calloc(uint num, uint size);
+uint MemFragment();
+void MemSetGrow(MemGrowFunc grow, MemShrinkFunc shrink);
+void MemGetStat(MemStat* stat);
+
+//每个任务一份的小对象缓存, 命中时分配和释放都不需要加锁
+typedef struct
+{
+    void* free[MC_CLASS_NUM];
+    uint cnt[MC_CLASS_NUM];
+} MemCache;
+
+void MemSetLock(MemLockFunc lock, MemLockFunc unlock);
+void MemSetCache(MemCache* cache, uint num, const volatile uint* slot);
+
+void ArenaInit(Arena* arena);
+void* ArenaAlloc(Arena* arena, uint size);
+void ArenaFree(void* ptr);
+void ArenaRelease(Arena* arena);
 
 #endif
@@ -1,39 +1,46 @@
-
 #include "mutex.h"
 #include "memory.h"
 #include "task.h"
 #include "event.h"
 
+//使用过某把锁的任务, 从该任务的arena中分配
+typedef struct
+{
+    ListNode head;
+    uint task;
+} MutexUser;
+
 static List gMList = {0};
+static uint gMutexId = 1;
 
-//创建一把锁,返回锁变量的地址
-static Mutex* SysCreateMutex(uint type)
+//返回给应用的是递增的锁id而不是锁的地址, 锁销毁后地址被重新分配时旧id也不会通过检查
+static Mutex* FindMutex(uint id)
 {
-    Mutex* ret = Malloc(sizeof(Mutex));
+    Mutex* ret = NULL;
+    ListNode* pos = NULL;
     
-    if( ret )
+    List_ForEach(&gMList, pos)
     {
-        Queue_Init(&ret->wait);
-        
-        ret->lock = 0;  
-        ret->type = type;
-        
-        List_Add(&gMList, (ListNode*)ret);
+        if( ((Mutex*)pos)->id == id )
+        {
+            ret = (Mutex*)pos;
+            break;
+        }
     }
-    //互斥锁的地址作为互斥锁id返回
+    
     return ret;
 }
 
-static uint IsMutexValid(Mutex* mutex)
+static MutexUser* FindUser(Mutex* mutex, uint task)
 {
-    uint ret = 0;
+    MutexUser* ret = NULL;
     ListNode* pos = NULL;
     
-    List_ForEach(&gMList, pos)
+    List_ForEach(&mutex->users, pos)
     {
-        if( IsEqual(pos, mutex) )
+        if( ((MutexUser*)pos)->task == task )
         {
-            ret = 1;
+            ret = (MutexUser*)pos;
             break;
         }
     }
@@ -41,41 +48,100 @@ static uint IsMutexValid(Mutex* mutex)
     return ret;
 }
 
-static void SysDestroyMutex(Mutex* mutex, uint* result)
+//当前任务第一次使用这把锁时记为使用者, 锁在最后一个使用者结束时才被销毁
+static uint AddUser(Mutex* mutex)
+{
+    uint ret = !!FindUser(mutex, CurrentTaskId());
+    
+    if( !ret )
+    {
+        MutexUser* user = ArenaAlloc(CurrentTaskArena(), sizeof(MutexUser));
+        
+        if( ret = !!user )
+        {
+            user->task = CurrentTaskId();
+            
+            List_Add(&mutex->users, (ListNode*)user);
+        }
+    }
+    
+    return ret;
+}
+
+//唤醒等待者, 它们重新尝试时发现锁已不存在而失败
+static void DestroyMutex(Mutex* mutex)
+{
+    Event evt = {MutexEvent, (uint)mutex, 0, 0};
+    
+    List_DelNode((ListNode*)mutex);
+    
+    EventSchedule(NOTIFY, &evt);
+    
+    while( !List_IsEmpty(&mutex->users) )
+    {
+        ListNode* user = mutex->users.next;
+        
+        List_DelNode(user);
+        
+        ArenaFree(user);
+    }
+    
+    Free(mutex);
+}
+
+//创建一把锁,返回锁id, 失败返回0; 锁可能比创建它的任务存在得更久, 所以从全局堆分配
+static uint SysCreateMutex(uint type)
 {
+    uint ret = 0;
+    Mutex* mutex = Malloc(sizeof(Mutex));
+    
     if( mutex )
     {
-        ListNode* pos = NULL;
+        Queue_Init(&mutex->wait);
+        List_Init(&mutex->users);
         
-        *result = 0;
-        //链表遍历,地址是否相同
-        List_ForEach(&gMList, pos)
+        mutex->lock = 0;  
+        mutex->type = type;
+        mutex->id = gMutexId++;
+        
+        if( AddUser(mutex) )
         {
-            if( IsEqual(pos, mutex) )
-            {
-                if( IsEqual(mutex->lock, 0) )
-                {
-                    List_DelNode(pos);
-                    
-                    Free(pos);
-                    
-                    *result = 1;
-                }
-                
-                break;
-            }
+            List_Add(&gMList, (ListNode*)mutex);
+            
+            ret = mutex->id;
+        }
+        else
+        {
+            Free(mutex);
         }
     }
+    
+    return ret;
+}
+
+static void SysDestroyMutex(uint id, uint* result)
+{
+    Mutex* mutex = FindMutex(id);
+    
+    *result = 0;
+    
+    if( mutex && IsEqual(mutex->lock, 0) )
+    {
+        DestroyMutex(mutex);
+        
+        *result = 1;
+    }
 }
 
+//无法创建等待事件时不进入等待, 应用立即重试
 static void DoWait(Mutex* mutex, uint* wait)
 {
     Event* evt = CreateEvent(MutexEvent, (uint)mutex, 0, 0);
     
+    *wait = MutexWait;
+    
     if( evt )
     {
-        *wait = 1;
-        
         EventSchedule(WAIT, evt);
     }
 }
@@ -90,7 +156,7 @@ static void SysNormalEnter(Mutex* mutex, uint* wait)
     {
         mutex->lock = 1;
         
-        *wait = 0;
+        *wait = MutexEntered;
     }
 }
 
@@ -100,7 +166,7 @@ static void SysStrictEnter(Mutex* mutex,uint* wait)
     {
         if( mutex->lock == CurrentTaskId() )
         {
-            *wait = 0;
+            *wait = MutexEntered;
         }
         else
         {         
@@ -111,13 +177,15 @@ static void SysStrictEnter(Mutex* mutex,uint* wait)
     {
         mutex->lock = CurrentTaskId();
             
-        *wait = 0;
+        *wait = MutexEntered;
     }
 }
 
-static void SysEnterCritical(Mutex* mutex, uint* wait)
+static void SysEnterCritical(uint id, uint* wait)
 {
-    if( mutex && IsMutexValid(mutex) )
+    Mutex* mutex = FindMutex(id);
+    
+    if( mutex && AddUser(mutex) )
     { 
         switch(mutex->type)
         {   //占用状态,任务只能进入等待状态
@@ -129,9 +197,14 @@ static void SysEnterCritical(Mutex* mutex, uint* wait)
                 SysStrictEnter(mutex, wait);
                 break;
             default:
+                *wait = MutexInvalid;
                 break;
         }
     }
+    else
+    {   //锁不存在或已被销毁, 等待者不再重试, EnterCritical返回失败
+        *wait = MutexInvalid;
+    }
 }
 
 static void SysNormalExit(Mutex* mutex)
@@ -156,9 +229,11 @@ static void SysStrictExit(Mutex* mutex)
 }
 
 
-void SysExitCritical(Mutex* mutex)
+void SysExitCritical(uint id)
 {
-    if( mutex && IsMutexValid(mutex) )
+    Mutex* mutex = FindMutex(id);
+    
+    if( mutex )
     {
         switch(mutex->type)
         {
@@ -180,6 +255,37 @@ void MutexModInit()
     List_Init(&gMList);
 }
 
+//任务结束时: 释放它以Strict方式占用的锁, 不再是它使用过的锁的使用者, 没有使用者的锁被销毁并唤醒等待者
+void MutexTaskExit(uint id)
+{
+    ListNode* pos = gMList.next;
+    
+    while( !IsEqual(pos, &gMList) )
+    {
+        Mutex* mutex = (Mutex*)pos;
+        MutexUser* user = FindUser(mutex, id);
+        
+        pos = pos->next;
+        
+        if( (mutex->type == Strict) && (mutex->lock == id) )
+        {
+            SysNormalExit(mutex);
+        }
+        
+        if( user )
+        {
+            List_DelNode((ListNode*)user);
+            
+            ArenaFree(user);
+        }
+        
+        if( List_IsEmpty(&mutex->users) )
+        {
+            DestroyMutex(mutex);
+        }
+    }
+}
+
 //cmd子功能号
 void MutexCallHandler(uint cmd, uint param1, uint param2)
 {
@@ -187,19 +293,19 @@ void MutexCallHandler(uint cmd, uint param1, uint param2)
     {
         uint* pRet = (uint*)param1;
         
-        *pRet = (uint)SysCreateMutex(param2);
+        *pRet = SysCreateMutex(param2);
     }
     else if( cmd == 1 )
     {
-        SysEnterCritical((Mutex*)param1, (uint*)param2);
+        SysEnterCritical(param1, (uint*)param2);
     }
     else if( cmd == 2 )
     {
-        SysExitCritical((Mutex*)param1);
+        SysExitCritical(param1);
     }
     else 
     {
-        SysDestroyMutex((Mutex*)param1, (uint*)param2);
+        SysDestroyMutex(param1, (uint*)param2);
     }
 }
 
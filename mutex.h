@@ -11,16 +11,27 @@ enum
     Strict
 };
 
+//进入临界区的结果, 与应用端EnterCritical一致
+enum
+{
+    MutexEntered,
+    MutexWait,          //已进入等待队列, 被唤醒后重新尝试
+    MutexInvalid
+};
+
 typedef struct 
 {
     ListNode head;      //链表
     Queue wait;         //
     uint type;          //
     uint lock;          //0表示占用 1表示空闲
+    uint id;            //返回给应用的锁id, 不重复使用
+    List users;         //使用过此锁且仍未结束的任务
 } Mutex;
 
 void MutexModInit();
 void MutexCallHandler(uint cmd, uint param1, uint param2);
+void MutexTaskExit(uint id);
 
 
 #endif
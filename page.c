@@ -0,0 +1,205 @@
+
+#include "page.h"
+#include "const.h"
+#include "list.h"
+
+#define PAGE_MAX_ORDER  10                      //最大块为2^10页(4MB)
+#define PAGE_ORDER_NUM  (PAGE_MAX_ORDER + 1)
+#define PAGE_FREE       0x80                    //块首页信息的最高位: 空闲
+#define PAGE_USED       0x40                    //已分配块的首页, 块内其余页和被合并的页信息为0
+#define PAGE_ORDER_MASK 0x0F
+
+//伙伴系统管理页表之后到物理内存末尾的物理页, 线性地址与物理地址一一对应
+//区域开头存放每页1字节的信息表: 块首页记录块的阶数和空闲或已分配标志; 之后是每页1字节的共享计数
+//空闲块按阶数挂入链表, 链表节点存放在空闲块的首页中
+static uint gPageBase = 0;                      //第一个被管理的页
+static uint gPageNum = 0;                       //被管理的页数
+static byte* gPageInfo = NULL;
+static byte* gPageRef = NULL;                   //除分配者之外还有几个页目录共享此块, 用于写时复制
+static List gPageArea[PAGE_ORDER_NUM] = {0};
+static uint gPageCnt = 0;                       //剩余空闲页数
+
+static void* PageAddr(uint idx)
+{
+    return (void*)(gPageBase + idx * PAGE_SIZE);
+}
+
+static uint PageIndex(void* page)
+{
+    return ((uint)page - gPageBase) / PAGE_SIZE;
+}
+
+static void AddBlock(uint idx, uint order)
+{
+    gPageInfo[idx] = PAGE_FREE | order;
+    
+    List_Add(&gPageArea[order], (ListNode*)PageAddr(idx));
+}
+
+static void DelBlock(uint idx)
+{
+    gPageInfo[idx] = 0;
+    
+    List_DelNode((ListNode*)PageAddr(idx));
+}
+
+void PageModInit(uint begin, uint end)
+{
+    uint i = 0;
+    uint meta = 0;
+    
+    begin = (begin + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end = end & ~(PAGE_SIZE - 1);
+    
+    gPageNum = (end > begin) ? (end - begin) / PAGE_SIZE : 0;
+    meta = (gPageNum * 2 + PAGE_SIZE - 1) / PAGE_SIZE;
+    gPageNum = (gPageNum > meta) ? (gPageNum - meta) : 0;
+    gPageInfo = (byte*)begin;
+    gPageRef = gPageInfo + gPageNum;
+    gPageBase = begin + meta * PAGE_SIZE;
+    gPageCnt = gPageNum;
+    
+    for(i=0; i<PAGE_ORDER_NUM; i++)
+    {
+        List_Init(&gPageArea[i]);
+    }
+    
+    //按对齐情况把全部页切成尽可能大的块
+    i = 0;
+    
+    while( i < gPageNum )
+    {
+        uint order = PAGE_MAX_ORDER;
+        
+        while( (i & ((1 << order) - 1)) || ((i + (1 << order)) > gPageNum) )
+        {
+            order--;
+        }
+        
+        AddBlock(i, order);
+        
+        i += (1 << order);
+    }
+}
+
+//找到不小于order的最小空闲块, 多余部分逐级对半拆分放回链表
+static void* AllocBlock(uint order)
+{
+    void* ret = NULL;
+    uint cur = order;
+    
+    while( (cur < PAGE_ORDER_NUM) && List_IsEmpty(&gPageArea[cur]) )
+    {
+        cur++;
+    }
+    
+    if( cur < PAGE_ORDER_NUM )
+    {
+        uint idx = PageIndex(gPageArea[cur].next);
+        
+        DelBlock(idx);
+        
+        while( cur > order )
+        {
+            cur--;
+            
+            AddBlock(idx + (1 << cur), cur);
+        }
+        
+        gPageInfo[idx] = PAGE_USED | order;
+        gPageRef[idx] = 0;
+        gPageCnt -= (1 << order);
+        
+        ret = PageAddr(idx);
+    }
+    
+    return ret;
+}
+
+void* PageAlloc()
+{
+    return AllocBlock(0);
+}
+
+//连续的n个页, 按2的幂向上取整, 用于DMA缓冲区等需要物理连续的场合
+void* PageAllocN(uint n)
+{
+    void* ret = NULL;
+    uint order = 0;
+    
+    while( (order < PAGE_ORDER_NUM) && ((1 << order) < n) )
+    {
+        order++;
+    }
+    
+    if( n && (order < PAGE_ORDER_NUM) )
+    {
+        ret = AllocBlock(order);
+    }
+    
+    return ret;
+}
+
+//只有已分配块的首页有效, 块内的页, 空闲块和已被合并的页都不是
+static uint IsUsedBlock(void* page)
+{
+    uint idx = PageIndex(page);
+    
+    return page && !((uint)page & (PAGE_SIZE - 1)) && ((uint)page >= gPageBase) && (idx < gPageNum) && (gPageInfo[idx] & PAGE_USED);
+}
+
+//块多了一个共享者, 之后每个共享者各调用一次PageFree, 最后一次才真正释放
+void PageShare(void* page)
+{
+    if( IsUsedBlock(page) )
+    {
+        gPageRef[PageIndex(page)]++;
+    }
+}
+
+uint PageShared(void* page)
+{
+    return IsUsedBlock(page) && gPageRef[PageIndex(page)];
+}
+
+//释放整个块, 伙伴也空闲时逐级合并; 块仍被共享时只减少共享计数
+void PageFree(void* page)
+{
+    uint idx = PageIndex(page);
+    
+    if( PageShared(page) )
+    {
+        gPageRef[idx]--;
+    }
+    else if( IsUsedBlock(page) )
+    {
+        uint order = gPageInfo[idx] & PAGE_ORDER_MASK;
+        
+        gPageCnt += (1 << order);
+        
+        while( order < PAGE_MAX_ORDER )
+        {
+            uint buddy = idx ^ (1 << order);
+            
+            if( (buddy < gPageNum) && (gPageInfo[buddy] == (PAGE_FREE | order)) )
+            {
+                DelBlock(buddy);
+                
+                gPageInfo[idx] = 0;
+                idx = Min(idx, buddy);
+                order++;
+            }
+            else
+            {
+                break;
+            }
+        }
+        
+        AddBlock(idx, order);
+    }
+}
+
+uint PageFreeCount()
+{
+    return gPageCnt;
+}
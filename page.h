@@ -0,0 +1,15 @@
+
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "type.h"
+
+void PageModInit(uint begin, uint end);
+void* PageAlloc();
+void* PageAllocN(uint n);
+void PageFree(void* page);
+void PageShare(void* page);
+uint PageShared(void* page);
+uint PageFreeCount();
+
+#endif
@@ -0,0 +1,70 @@
+
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR  0xCF8
+#define PCI_CONFIG_DATA  0xCFC
+
+extern uint ReadPortL(ushort port);
+extern void WritePortL(ushort port, uint value);
+
+//dev为总线号, 设备号, 功能号组成的配置空间地址: bus << 16 | dev << 11 | func << 8
+static uint MakeAddr(uint dev, uint off)
+{
+    return 0x80000000 | dev | (off & 0xFC);
+}
+
+uint PciRead(uint dev, uint off)
+{
+    WritePortL(PCI_CONFIG_ADDR, MakeAddr(dev, off));
+    
+    return ReadPortL(PCI_CONFIG_DATA);
+}
+
+void PciWrite(uint dev, uint off, uint value)
+{
+    WritePortL(PCI_CONFIG_ADDR, MakeAddr(dev, off));
+    WritePortL(PCI_CONFIG_DATA, value);
+}
+
+//按总线顺序查找配置空间off处(value & mask)相等的第index个功能, 没有找到返回PCI_NONE
+uint PciFind(uint off, uint mask, uint value, uint index)
+{
+    uint ret = PCI_NONE;
+    uint bus = 0;
+    uint slot = 0;
+    uint func = 0;
+    
+    for(bus=0; (ret == PCI_NONE) && (bus<256); bus++)
+    {
+        for(slot=0; (ret == PCI_NONE) && (slot<32); slot++)
+        {
+            uint dev = (bus << 16) | (slot << 11);
+            uint funcs = (PciRead(dev, PCI_HEADER) & 0x800000) ? 8 : 1;    //多功能设备
+            
+            for(func=0; (ret == PCI_NONE) && (func<funcs); func++)
+            {
+                uint addr = dev | (func << 8);
+                
+                if( ((PciRead(addr, PCI_ID) & 0xFFFF) != 0xFFFF) && ((PciRead(addr, off) & mask) == value) )
+                {
+                    ret = index ? PCI_NONE : addr;
+                    
+                    if( index )
+                    {
+                        index--;
+                    }
+                }
+            }
+        }
+    }
+    
+    return ret;
+}
+
+//打开I/O空间, 内存空间或总线主控(DMA)
+void PciEnable(uint dev, uint cmd)
+{
+    uint value = PciRead(dev, PCI_COMMAND);
+    
+    PciWrite(dev, PCI_COMMAND, (value & 0xFFFF) | cmd);
+}
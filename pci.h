@@ -0,0 +1,25 @@
+
+#ifndef PCI_H
+#define PCI_H
+
+#include "type.h"
+
+#define PCI_NONE       0xFFFFFFFF
+
+#define PCI_ID         0x00        //厂商ID(低16位)与设备ID(高16位)
+#define PCI_COMMAND    0x04
+#define PCI_CLASS      0x08        //版本号, 编程接口, 子类, 类别
+#define PCI_HEADER     0x0C        //第16~23位为头部类型
+#define PCI_BAR0       0x10
+#define PCI_IRQ        0x3C
+
+#define PCI_CMD_IO     0x01
+#define PCI_CMD_MEM    0x02
+#define PCI_CMD_MASTER 0x04
+
+uint PciRead(uint dev, uint off);
+void PciWrite(uint dev, uint off, uint value);
+uint PciFind(uint off, uint mask, uint value, uint index);
+void PciEnable(uint dev, uint cmd);
+
+#endif
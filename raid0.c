@@ -0,0 +1,192 @@
+
+#include "raid0.h"
+#include "ata.h"
+#include "utility.h"
+
+#define R0_STRIPE      16          //条带单元: 每块成员盘连续存放16个扇区(8KB)
+#define R0_MAX_SEGS    16          //一条命令最多包含的请求数
+#define R0_WAIT_LIMIT  0x1000000   //所有成员盘都没有进展时的最大轮询次数
+
+//一条阵列命令在一块成员盘上对应的连续扇区
+typedef struct
+{
+    ATADrive* drv;
+    uint si;                        //成员盘上的起始扇区
+    uint cnt;                       //扇区数
+    uint done;                      //已传输的扇区数
+    uint started;                   //已向成员盘发出命令
+} R0Job;
+
+static ATADrive* gR0Member[ATA_DRIVE_NUM] = {0};
+static uint gR0Num = 0;
+static uint gR0Sectors = -1;
+static uint gR0MaxSectors = 0;
+
+static uint R0Sectors()
+{
+    return gR0Sectors;
+}
+
+static uint R0MaxSectors()
+{
+    return gR0MaxSectors;
+}
+
+//阵列扇区 = (条带行 * 成员数 + 成员号) * 条带单元 + 单元内偏移
+static uint ToArray(uint member, uint msi)
+{
+    return ((msi / R0_STRIPE) * gR0Num + member) * R0_STRIPE + (msi % R0_STRIPE);
+}
+
+static void Split(HDCommand* cmd, R0Job* job)
+{
+    uint si = cmd->si;
+    uint end = cmd->si + cmd->cnt;
+    
+    while( si < end )
+    {
+        uint unit = si / R0_STRIPE;
+        uint member = unit % gR0Num;
+        uint cnt = Min(R0_STRIPE - (si % R0_STRIPE), end - si);
+        
+        if( !job[member].cnt )
+        {
+            job[member].si = (unit / gR0Num) * R0_STRIPE + (si % R0_STRIPE);
+        }
+        
+        job[member].cnt += cnt;
+        
+        si += cnt;
+    }
+}
+
+//阵列扇区在命令数据中的位置, 命令中的请求按LBA连续排列
+static byte* FindBuf(HDCommand* cmd, uint si)
+{
+    byte* ret = NULL;
+    uint off = si - cmd->si;
+    ListNode* pos = NULL;
+    
+    List_ForEach(&cmd->reqs, pos)
+    {
+        HDRequest* req = (HDRequest*)pos;
+        
+        if( off < req->cnt )
+        {
+            ret = AddrOff(req->buf, off * SECT_SIZE);
+            break;
+        }
+        
+        off -= req->cnt;
+    }
+    
+    return ret;
+}
+
+//成员盘可以开始新命令: 同一通道上的另一块盘没有未完成的命令
+static uint IsChannelFree(R0Job* job, uint member)
+{
+    uint ret = 1;
+    uint i = 0;
+    
+    for(i=0; ret && (i<gR0Num); i++)
+    {
+        ret = (i == member) || (job[i].drv->base != job[member].drv->base) || !job[i].started || (job[i].done == job[i].cnt);
+    }
+    
+    return ret && !(ATAStatus(job[member].drv) & STATUS_BSY);
+}
+
+//先向每个通道各发出一条命令, 再轮流传输已经就绪(DRQ)的扇区, 两个通道的寻道和读写可以同时进行
+static void R0Issue(HDCommand* cmd)
+{
+    R0Job job[ATA_DRIVE_NUM] = {0};
+    uint left = cmd->cnt;
+    uint ok = 1;
+    uint idle = 0;
+    uint i = 0;
+    
+    for(i=0; i<gR0Num; i++)
+    {
+        job[i].drv = gR0Member[i];
+    }
+    
+    Split(cmd, job);
+    
+    while( ok && left && (idle < R0_WAIT_LIMIT) )
+    {
+        idle++;
+        
+        for(i=0; ok && (i<gR0Num); i++)
+        {
+            R0Job* pj = job + i;
+            
+            if( pj->done < pj->cnt )
+            {
+                if( !pj->started && IsChannelFree(job, i) )
+                {
+                    ok = pj->started = ATACommand(pj->drv, pj->si, pj->cnt, cmd->write);
+                }
+                else if( pj->started )
+                {
+                    byte status = ATAStatus(pj->drv);
+                    
+                    if( ok = !(status & STATUS_ERR) )
+                    {
+                        if( !(status & STATUS_BSY) && (status & STATUS_DRQ) )
+                        {
+                            byte* buf = FindBuf(cmd, ToArray(i, pj->si + pj->done));
+                            
+                            ok = ATATransfer(pj->drv, buf, cmd->write);
+                            
+                            pj->done++;
+                            left--;
+                            idle = 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    HDRawComplete(cmd, ok && !left);
+}
+
+static HDDevice gR0Device = { "raid0", 1, R0_MAX_SEGS, R0Sectors, R0MaxSectors, R0Issue, NULL };
+
+//把所有存在的ATA硬盘组成RAID-0, 容量按最小的成员盘计算, 至少需要两块盘
+const HDDevice* Raid0ModInit()
+{
+    const HDDevice* ret = NULL;
+    uint sectors = -1;
+    uint maxSectors = -1;
+    uint i = 0;
+    
+    gR0Num = 0;
+    
+    for(i=0; i<ATA_DRIVE_NUM; i++)
+    {
+        ATADrive* drv = ATAGetDrive(i);
+        
+        if( drv )
+        {
+            gR0Member[gR0Num++] = drv;
+            
+            sectors = Min(sectors, drv->sectors);
+            maxSectors = Min(maxSectors, ATAMaxSectors(drv));
+        }
+    }
+    
+    if( gR0Num > 1 )
+    {
+        uint rows = sectors / R0_STRIPE;
+        
+        //每块成员盘最多多出一个不完整的条带单元, 保证单条成员命令不超过成员盘的上限
+        gR0MaxSectors = gR0Num * R0_STRIPE * (maxSectors / R0_STRIPE - 1);
+        gR0Sectors = (rows > (HD_MAX_SCT_NUM / R0_STRIPE / gR0Num)) ? HD_MAX_SCT_NUM : rows * R0_STRIPE * gR0Num;
+        
+        ret = &gR0Device;
+    }
+    
+    return ret;
+}
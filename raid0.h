@@ -0,0 +1,9 @@
+
+#ifndef RAID0_H
+#define RAID0_H
+
+#include "hdraw.h"
+
+const HDDevice* Raid0ModInit();
+
+#endif
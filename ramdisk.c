@@ -0,0 +1,95 @@
+
+#include "ramdisk.h"
+#include "const.h"
+#include "page.h"
+#include "memory.h"
+#include "utility.h"
+
+#define RD_SCT_PER_PAGE  (PAGE_SIZE / SECT_SIZE)
+#define RD_MAX_SECTORS   0xFFFF
+
+//内存盘: 每个物理页存放RD_SCT_PER_PAGE个扇区, 页在第一次写入时才分配, 从未写过的扇区读出全0
+static byte** gRDPages = NULL;
+static uint gRDPageNum = 0;
+
+static uint RDSectors()
+{
+    return gRDPageNum ? gRDPageNum * RD_SCT_PER_PAGE : -1;
+}
+
+static uint RDMaxSectors()
+{
+    return RD_MAX_SECTORS;
+}
+
+static uint RDTransfer(HDRequest* req)
+{
+    uint ret = 1;
+    uint i = 0;
+    
+    for(i=0; ret && (i<req->cnt); i++)
+    {
+        uint si = req->si + i;
+        byte** page = AddrOff(gRDPages, si / RD_SCT_PER_PAGE);
+        byte* data = AddrOff(req->buf, i * SECT_SIZE);
+        
+        if( req->write && !*page && (*page = PageAlloc()) )
+        {
+            MemSet(*page, PAGE_SIZE, 0);
+        }
+        
+        if( *page )
+        {
+            byte* sct = AddrOff(*page, (si % RD_SCT_PER_PAGE) * SECT_SIZE);
+            
+            if( req->write )
+            {
+                MemCpy(sct, data, SECT_SIZE);
+            }
+            else
+            {
+                MemCpy(data, sct, SECT_SIZE);
+            }
+        }
+        else if( ret = !req->write )
+        {
+            MemSet(data, SECT_SIZE, 0);
+        }
+    }
+    
+    return ret;
+}
+
+//内存拷贝同步完成, 扇区范围已由HDRawSubmit检查
+static void RDIssue(HDCommand* cmd)
+{
+    ListNode* pos = NULL;
+    uint ok = 1;
+    
+    List_ForEach(&cmd->reqs, pos)
+    {
+        ok = ok && RDTransfer((HDRequest*)pos);
+    }
+    
+    HDRawComplete(cmd, ok);
+}
+
+static const HDDevice gRDDevice = { "ram", 1, 0xFFFF, RDSectors, RDMaxSectors, RDIssue, NULL };
+
+//容量不超过size字节, 也不超过当前的空闲物理页数
+const HDDevice* RamDiskModInit(uint size)
+{
+    const HDDevice* ret = NULL;
+    uint pages = Min(size / PAGE_SIZE, PageFreeCount());
+    
+    if( !gRDPages && pages && (gRDPages = Malloc(pages * sizeof(*gRDPages))) )
+    {
+        MemSet((byte*)gRDPages, pages * sizeof(*gRDPages), 0);
+        
+        gRDPageNum = pages;
+        
+        ret = &gRDDevice;
+    }
+    
+    return ret;
+}
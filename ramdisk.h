@@ -0,0 +1,9 @@
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "hdraw.h"
+
+const HDDevice* RamDiskModInit(uint size);
+
+#endif
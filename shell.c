@@ -3,6 +3,7 @@
 #include "screen.h"
 #include "utility.h"
 #include "list.h"
+#include "memory.h"
 #include "demo1.h"
 #include "demo2.h"
 
@@ -55,6 +56,89 @@ static void Mem()
     PrintString(" MB\n");
 }
 
+static void Disk()
+{
+    int w = 0;
+    
+    SetPrintPos(CMD_START_W, CMD_START_H + 1);
+    
+    for(w=CMD_START_W; w<SCREEN_WIDTH; w++)
+    {
+        PrintChar(' ');
+    }
+    
+    SetPrintPos(CMD_START_W, CMD_START_H + 1);
+    PrintString("Disk Queue: depth ");
+    PrintIntDec(GetDiskStat(DiskDepth));
+    PrintChar('/');
+    PrintIntDec(GetDiskStat(DiskMaxDepth));
+    PrintString(" req ");
+    PrintIntDec(GetDiskStat(DiskSubmitted));
+    PrintString(" cmd ");
+    PrintIntDec(GetDiskStat(DiskCommands));
+    PrintString(" merged ");
+    PrintIntDec(GetDiskStat(DiskMerged));
+    PrintString(" expired ");
+    PrintIntDec(GetDiskStat(DiskExpired));
+    PrintChar('\n');
+}
+
+static void HeapStat()
+{
+    int i = 0;
+    int w = 0;
+    
+    SetPrintPos(CMD_START_W, CMD_START_H + 1);
+    
+    for(w=CMD_START_W; w<SCREEN_WIDTH; w++)
+    {
+        PrintChar(' ');
+    }
+    
+    SetPrintPos(CMD_START_W, CMD_START_H + 1);
+    PrintString("Kernel Heap: used ");
+    PrintIntDec(GetHeapStat(HeapUsed));
+    PrintChar('/');
+    PrintIntDec(GetHeapStat(HeapTotal));
+    PrintString(" peak ");
+    PrintIntDec(GetHeapStat(HeapPeak));
+    PrintString(" largest ");
+    PrintIntDec(GetHeapStat(HeapLargest));
+    PrintString(" frag ");
+    PrintIntDec(GetHeapStat(HeapFragment));
+    PrintString("% fails ");
+    PrintIntDec(GetHeapStat(HeapFails));
+    
+    SetPrintPos(CMD_START_W, CMD_START_H + 2);
+    
+    for(w=CMD_START_W; w<SCREEN_WIDTH; w++)
+    {
+        PrintChar(' ');
+    }
+    
+    SetPrintPos(CMD_START_W, CMD_START_H + 2);
+    PrintString("Live:");
+    
+    for(i=0; i<MS_CLASS_NUM; i++)
+    {
+        PrintChar(' ');
+        
+        if( i < SM_CLASS_NUM )
+        {
+            PrintIntDec(SM_CLASS_SIZE(i));
+        }
+        else
+        {
+            PrintChar('V');
+        }
+        
+        PrintChar('=');
+        PrintIntDec(GetHeapStat(HeapLive + i));
+    }
+    
+    PrintChar('\n');
+}
+
 static void Clear()
 {
     int h = 0;
@@ -226,6 +310,8 @@ void Shell()
     
     AddCmdEntry("mem", Mem);
     AddCmdEntry("clear", Clear);
+    AddCmdEntry("disk", Disk);
+    AddCmdEntry("memstat", HeapStat);
     AddCmdEntry("demo1", Demo1);
     AddCmdEntry("demo2", Demo2);
     
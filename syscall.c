@@ -42,6 +42,39 @@ void RegApp(const char* name, void(*tmain)(), byte pri)
 }
 
 
+void* Sbrk(uint incr)
+{
+    volatile uint ret = 0;
+    
+    SysCall(0, 3, incr, &ret);
+    
+    return (void*)ret;
+}
+
+void* TaskSbrk(uint incr)
+{
+    volatile uint ret = 0;
+    
+    SysCall(0, 4, incr, &ret);
+    
+    return (void*)ret;
+}
+
+int Fork()
+{
+    volatile uint ret = -1;
+    
+    SysCall(0, 5, &ret, 0);
+    
+    return (int)ret;
+}
+
+//放弃剩余的时间片, 级别更低的任务也能在本任务之前执行
+void Yield()
+{
+    SysCall(0, 6, 0, 0);
+}
+
 uint CreateMutex(uint type)
 {
     volatile uint ret = 0;
@@ -51,14 +84,17 @@ uint CreateMutex(uint type)
     return ret;
 }
 
-void EnterCritical(uint mutex)
+//进入临界区返回1, 锁不存在(从未创建或已被销毁)时返回0
+uint EnterCritical(uint mutex)
 {
     volatile uint wait = 0;
     do
     {   //80号中断 使用功能1(互斥锁功能)的子功能1(进入互斥区)
         SysCall(1, 1, mutex, &wait);
     }    //必须要增加while循环,避免多个进程恢复执行状态时全都直接进入临界区
-    while( wait );//每次都需要竞争,只有一个进程能跳出while进入临界区
+    while( wait == MutexWait );//每次都需要竞争,只有一个进程能跳出while进入临界区
+    
+    return wait == MutexEntered;
 }
 
 void ExitCritical(uint mutex)
@@ -93,3 +129,206 @@ uint GetMemSize()
     return ret;
 }
 
+uint GetDiskStat(uint item)
+{
+    uint ret = 0;
+    
+    SysCall(3, 1, &ret, item);
+    
+    return ret;
+}
+
+uint GetHeapStat(uint item)
+{
+    uint ret = 0;
+    
+    SysCall(3, 2, &ret, item);
+    
+    return ret;
+}
+
+uint FCreate(const char* fn)
+{
+    FSParam param = {0};
+    
+    param.name = fn;
+    param.ret = FS_FAILED;
+    
+    SysCall(4, 0, &param, 0);
+    
+    return param.ret;
+}
+
+uint FExisted(const char* fn)
+{
+    FSParam param = {0};
+    
+    param.name = fn;
+    param.ret = FS_FAILED;
+    
+    SysCall(4, 1, &param, 0);
+    
+    return param.ret;
+}
+
+uint FDelete(const char* fn)
+{
+    FSParam param = {0};
+    
+    param.name = fn;
+    param.ret = FS_FAILED;
+    
+    SysCall(4, 2, &param, 0);
+    
+    return param.ret;
+}
+
+uint FRename(const char* ofn, const char* nfn)
+{
+    FSParam param = {0};
+    
+    param.name = ofn;
+    param.nname = nfn;
+    param.ret = FS_FAILED;
+    
+    SysCall(4, 3, &param, 0);
+    
+    return param.ret;
+}
+
+uint FOpen(const char* fn)
+{
+    volatile FSParam param = {0};
+    
+    param.name = fn;
+    
+    do
+    {   //文件被其他任务打开时内核令当前任务等待,文件关闭后重新竞争
+        SysCall(4, 4, &param, 0);
+    }
+    while( param.wait );
+    
+    return param.ret;
+}
+
+uint FWrite(uint fd, byte* buf, uint len)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.buf = buf;
+    param.len = len;
+    param.ret = -1;
+    
+    SysCall(4, 5, &param, 0);
+    
+    return param.ret;
+}
+
+uint FRead(uint fd, byte* buf, uint len)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.buf = buf;
+    param.len = len;
+    param.ret = -1;
+    
+    SysCall(4, 6, &param, 0);
+    
+    return param.ret;
+}
+
+void FClose(uint fd)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    
+    SysCall(4, 7, &param, 0);
+}
+
+uint FErase(uint fd, uint bytes)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.len = bytes;
+    
+    SysCall(4, 8, &param, 0);
+    
+    return param.ret;
+}
+
+uint FSeek(uint fd, uint pos)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.len = pos;
+    param.ret = -1;
+    
+    SysCall(4, 9, &param, 0);
+    
+    return param.ret;
+}
+
+uint FLength(uint fd)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.ret = -1;
+    
+    SysCall(4, 10, &param, 0);
+    
+    return param.ret;
+}
+
+uint FTell(uint fd)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.ret = -1;
+    
+    SysCall(4, 11, &param, 0);
+    
+    return param.ret;
+}
+
+uint FFlush(uint fd)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.ret = -1;
+    
+    SysCall(4, 12, &param, 0);
+    
+    return param.ret;
+}
+
+void* FMap(uint fd, uint offset, uint len)
+{
+    FSParam param = {0};
+    
+    param.fd = fd;
+    param.pos = offset;
+    param.len = len;
+    
+    SysCall(4, 13, &param, 0);
+    
+    return (void*)param.ret;
+}
+
+uint FUnmap(void* addr)
+{
+    FSParam param = {0};
+    
+    param.buf = addr;
+    
+    SysCall(4, 14, &param, 0);
+    
+    return param.ret;
+}
@@ -2,6 +2,7 @@
 #define SYSCALL_H
 
 #include "type.h"
+#include "fsparam.h"
 
 enum
 {
@@ -9,16 +10,70 @@ enum
     Strict
 };
 
+//EnterCritical的内部状态, 与内核mutex.h一致
+enum
+{
+    MutexEntered,
+    MutexWait,
+    MutexInvalid
+};
+
 void Exit();
 void Wait(const char* name);
 void RegApp(const char* name, void(*tmain)(), byte pri);
+void* Sbrk(uint incr);
+void* TaskSbrk(uint incr);
+int Fork();
+void Yield();
 
 uint CreateMutex(uint type);
-void EnterCritical(uint mutex);
+uint EnterCritical(uint mutex);
 void ExitCritical(uint mutex);
 uint DestroyMutex(uint mutex);
 
+enum
+{
+    DiskSubmitted,
+    DiskCommands,
+    DiskMerged,
+    DiskExpired,
+    DiskDepth,
+    DiskMaxDepth
+};
+
+//内核堆统计项, 顺序与MemStat一致; HeapLive + i为第i个大小类(16, 32 ... 2048字节, 最后是VMem)的已分配字节数
+enum
+{
+    HeapTotal,
+    HeapUsed,
+    HeapPeak,
+    HeapAreas,
+    HeapFails,
+    HeapLargest,
+    HeapFragment,
+    HeapLive
+};
+
 uint ReadKey();
 uint GetMemSize();
+uint GetDiskStat(uint item);
+uint GetHeapStat(uint item);
+
+uint FCreate(const char* fn);
+uint FExisted(const char* fn);
+uint FDelete(const char* fn);
+uint FRename(const char* ofn, const char* nfn);
+
+uint FOpen(const char* fn);
+uint FWrite(uint fd, byte* buf, uint len);
+uint FRead(uint fd, byte* buf, uint len);
+void FClose(uint fd);
+uint FErase(uint fd, uint bytes);
+uint FSeek(uint fd, uint pos);
+uint FLength(uint fd);
+uint FTell(uint fd);
+uint FFlush(uint fd);
+void* FMap(uint fd, uint offset, uint len);
+uint FUnmap(void* addr);
 
 #endif
@@ -1,5 +1,7 @@
 
 #include "sysinfo.h"
+#include "hdraw.h"
+#include "memory.h"
 
 uint gMemSize = 0;
 
@@ -11,4 +13,20 @@ void SysInfoCallHandler(uint cmd, uint param1, uint param2)
         
         *pRet = gMemSize;
     }
+    else if( cmd == 1 )
+    {
+        uint* pRet = (uint*)param1;
+        const uint* stat = (const uint*)HDRawGetStat();
+        
+        *pRet = (param2 < (sizeof(HDRawStat) / sizeof(uint))) ? stat[param2] : 0;
+    }
+    else if( cmd == 2 )
+    {
+        uint* pRet = (uint*)param1;
+        MemStat stat = {0};
+        
+        MemGetStat(&stat);
+        
+        *pRet = (param2 < (sizeof(MemStat) / sizeof(uint))) ? ((uint*)&stat)[param2] : 0;
+    }
 }
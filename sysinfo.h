@@ -3,6 +3,8 @@
 
 #include "type.h"
 
+extern uint gMemSize;
+
 void SysInfoCallHandler(uint cmd, uint param1, uint param2);
 
 #endif
@@ -3,27 +3,44 @@
 #include "mutex.h"
 #include "queue.h"
 #include "app.h"
+#include "fs.h"
+#include "kernel.h"
+#include "page.h"
+#include "fmap.h"
 
 #define MAX_TASK_NUM        16
-#define MAX_RUNNING_TASK    8
-#define MAX_READY_TASK      (MAX_TASK_NUM - MAX_RUNNING_TASK)
 #define MAX_TASK_BUFF_NUM   (MAX_TASK_NUM + 1)
+#define RUN_LEVEL_NUM       32
+#define RunLevel(pri)       ((pri) * RUN_LEVEL_NUM / 256)     //优先级数值越小级别越高
 #define PID_BASE            0x10
 #define MAX_TIME_SLICE      260
+#define SPACE_END           (TaskSpaceBase + TaskSpaceSize)
+#define SPACE_LIMIT         (SPACE_END / PAGE_SIZE - 1)
+#define SPACE_STACK_SIZE    0x100000
+#define SPACE_STACK         (SPACE_END - SPACE_STACK_SIZE)  //私有区域顶部保留给任务栈, 按需映射
 
 void (* const RunTask)(volatile Task* pt) = NULL;
 void (* const LoadTask)(volatile Task* pt) = NULL;
 
+//每个优先级一个运行队列, map的第i位为1表示第i级队列非空, bsf即可找到最高级别
+typedef struct
+{
+    uint  map;
+    Queue queue[RUN_LEVEL_NUM];
+} RunArray;
+
 volatile Task* gCTaskAddr = NULL; /* DO NOT USE IT DIRECTLY */
 
 static TaskNode gTaskBuff[MAX_TASK_BUFF_NUM] = {0};
 static Queue gAppToRun = {0};
 static Queue gFreeTaskNode = {0};
-static Queue gReadyTask = {0};
-static Queue gRunningTask = {0};
+static RunArray gRunArray[2] = {0};
+static RunArray* gActive = &gRunArray[0];       //时间片未用完的任务, 当前任务位于其级别队列的队首
+static RunArray* gExpired = &gRunArray[1];      //时间片已用完的任务, gActive为空时两者交换
 static TSS gTSS = {0};
 static TaskNode* gIdleTask = NULL;
 static uint gPid = PID_BASE;
+static uint gAppBrk = AppHeapBase + AppHeapInit;   //应用堆的结束地址, 之后的页不存在
 
 static void TaskEntry()
 {
@@ -44,7 +61,7 @@ static void IdleTask()
     while(1);
 }
 
-static void InitTask(Task* pt, uint id, const char* name, void(*entry)(), ushort pri)
+static void InitTask(Task* pt, uint id, const char* name, void(*entry)(), ushort pri, uint dir)
 {
     pt->rv.cs = LDT_CODE32_SELECTOR;
     pt->rv.gs = LDT_VIDEO_SELECTOR;
@@ -53,7 +70,8 @@ static void InitTask(Task* pt, uint id, const char* name, void(*entry)(), ushort
     pt->rv.fs = LDT_DATA32_SELECTOR;
     pt->rv.ss = LDT_DATA32_SELECTOR;
     
-    pt->rv.esp = (uint)pt->stack + AppStackSize;
+    //有自己页目录的任务在私有区域顶部使用栈, 各任务的栈地址相同, 复制任务时栈随私有区域写时复制
+    pt->rv.esp = (dir != PageDirBase) ? SPACE_END : ((uint)pt->stack + AppStackSize);
     pt->rv.eip = (uint)TaskEntry;
     pt->rv.eflags = 0x3202;
     
@@ -61,7 +79,12 @@ static void InitTask(Task* pt, uint id, const char* name, void(*entry)(), ushort
     pt->id = id;
     pt->current = 0;
     pt->total = MAX_TIME_SLICE - pri;
+    pt->pri = pri;
     pt->event = NULL;
+    pt->cr3 = dir;
+    pt->brk = TaskSpaceBase;
+    
+    ArenaInit(&pt->arena);
     
     if( name )
     {
@@ -75,8 +98,9 @@ static void InitTask(Task* pt, uint id, const char* name, void(*entry)(), ushort
     Queue_Init(&pt->wait);
     
     SetDescValue(AddrOff(pt->ldt, LDT_VIDEO_INDEX),  0xB8000, 0x07FFF, DA_DRWA + DA_32 + DA_DPL3);
-    SetDescValue(AddrOff(pt->ldt, LDT_CODE32_INDEX), 0x00,    KernelHeapBase - 1, DA_C + DA_32 + DA_DPL3);
-    SetDescValue(AddrOff(pt->ldt, LDT_DATA32_INDEX), 0x00,    KernelHeapBase - 1, DA_DRW + DA_32 + DA_DPL3);
+    //段界限覆盖到私有区域末尾(4K粒度), 内核使用的内存由页的U/S位保护
+    SetDescValue(AddrOff(pt->ldt, LDT_CODE32_INDEX), 0x00,    SPACE_LIMIT, DA_C + DA_32 + DA_LIMIT_4K + DA_DPL3);
+    SetDescValue(AddrOff(pt->ldt, LDT_DATA32_INDEX), 0x00,    SPACE_LIMIT, DA_DRW + DA_32 + DA_LIMIT_4K + DA_DPL3);
     
     pt->ldtSelector = GDT_TASK_LDT_SELECTOR;
     pt->tssSelector = GDT_TASK_TSS_SELECTOR;
@@ -114,132 +138,342 @@ static void PrepareForRun(volatile Task* pt)
     gTSS.iomb = sizeof(TSS);
     
     SetDescValue(AddrOff(gGdtInfo.entry, GDT_TASK_LDT_INDEX), (uint)&pt->ldt, sizeof(pt->ldt)-1, DA_LDT + DA_DPL0);
+    //任务槽号写入共享内存, 应用的内存分配器据此选择任务自己的缓存, 无需系统调用
+    *(uint*)CurrentTaskSlot = ((uint)pt - (uint)gTaskBuff) / sizeof(TaskNode);
+    //文件映射窗口的页表为所有任务共享, 只显示新任务自己的映射
+    FMapSwitch(pt->id);
+}
+
+static void RunArrayAdd(RunArray* ra, TaskNode* tn)
+{
+    uint level = RunLevel(tn->task.pri);
+    
+    Queue_Add(&ra->queue[level], (QueueNode*)tn);
+    
+    ra->map |= (1 << level);
+}
+
+static TaskNode* RunArrayRemove(RunArray* ra, uint level)
+{
+    TaskNode* ret = (TaskNode*)Queue_Remove(&ra->queue[level]);
+    
+    if( Queue_IsEmpty(&ra->queue[level]) )
+    {
+        ra->map &= ~(1 << level);
+    }
+    
+    return ret;
 }
 
-//创建任务进入就绪队列
+static uint IsIdle(volatile Task* pt)
+{
+    return IsEqual(pt, &gIdleTask->task);
+}
+
+//当前任务离开运行队列(进入等待队列或结束), 空闲任务不在运行队列中
+static TaskNode* RemoveCurrent()
+{
+    return IsIdle(gCTaskAddr) ? NULL : RunArrayRemove(gActive, RunLevel(gCTaskAddr->pri));
+}
+
+//创建任务进入运行队列
 static void CreateTask()
 {
-    while( (0 < Queue_Length(&gAppToRun)) && (Queue_Length(&gReadyTask) < MAX_READY_TASK) )
+    while( 0 < Queue_Length(&gAppToRun) )
     {
-        TaskNode* tn = (TaskNode*)Queue_Remove(&gFreeTaskNode);
+        uint dir = Queue_Length(&gFreeTaskNode) ? CreatePageDir() : 0;
+        TaskNode* tn = dir ? (TaskNode*)Queue_Remove(&gFreeTaskNode) : NULL;
         
         if( tn )
         {
             AppNode* an = (AppNode*)Queue_Remove(&gAppToRun); 
             
-            InitTask(&tn->task, gPid++, an->app.name, an->app.tmain, an->app.priority);
+            InitTask(&tn->task, gPid++, an->app.name, an->app.tmain, an->app.priority, dir);
             
-            Queue_Add(&gReadyTask, (QueueNode*)tn);
+            RunArrayAdd(gActive, tn);
             
             Free((void*)an->app.name);
             Free(an);
         }
         else
-        {
+        {   //没有空闲任务或页目录时应用留在队列中, 下次调度再创建
             break;
         }
     }
 }
 
-static void CheckRunningTask()
+//选出最高级别队列的队首任务, 没有可运行的任务时选择空闲任务
+static void PickNext()
 {
-    if( Queue_Length(&gRunningTask) == 0 )
+    CreateTask();
+    
+    if( !gActive->map )
     {
-        Queue_Add(&gRunningTask, (QueueNode*)gIdleTask);
+        RunArray* ra = gActive;
+        
+        gActive = gExpired;
+        gExpired = ra;
     }
-    else if( Queue_Length(&gRunningTask) > 1 )
+    
+    gCTaskAddr = gActive->map ? &((TaskNode*)Queue_Front(&gActive->queue[BitLow(gActive->map)]))->task : &gIdleTask->task;
+}
+
+static void RunningToWaitting(Queue* wq)
+{
+    TaskNode* tn = RemoveCurrent();
+    
+    if( tn )
     {
-        if( IsEqual(Queue_Front(&gRunningTask), (QueueNode*)gIdleTask) )
-        {
-            Queue_Remove(&gRunningTask);
-        }
+        Queue_Add(wq, (QueueNode*)tn);
     }
 }
 
-static void ReadyToRunning()
+//被唤醒的任务重新获得完整的时间片, 级别高于当前任务时在下一次调度时立即执行
+static void WaittingToReady(Queue* wq)
 {
-    QueueNode* node = NULL;
-    
-    if( Queue_Length(&gReadyTask) < MAX_READY_TASK )
+    while( Queue_Length(wq) > 0 )
     {
-        CreateTask();
+        TaskNode* tn = (TaskNode*)Queue_Front(wq);
+        //销毁任务,并且任务指针赋值为空
+        DestroyEvent(tn->task.event); 
+        tn->task.event = NULL;
+        tn->task.current = 0;
+        
+        Queue_Remove(wq);
+        RunArrayAdd(gActive, tn);
     }
+}
+
+static void AppInfoToRun(const char* name, void(*tmain)(), byte pri)
+{
+    AppNode* an = (AppNode*)Malloc(sizeof(AppNode));
     
-    while( (Queue_Length(&gReadyTask) > 0) && (Queue_Length(&gRunningTask) < MAX_RUNNING_TASK) )
+    if( an )
     {
-        node = Queue_Remove(&gReadyTask);
+        char* s = name ? (char*)Malloc(StrLen(name) + 1) : NULL;
         
-        ((TaskNode*)node)->task.current = 0;//当前任务的current赋值为0表示刚开始
+        an->app.name = s ? StrCpy(s, name, -1) : NULL;
+        an->app.tmain = tmain;
+        an->app.priority = pri;
         
-        Queue_Add(&gRunningTask, node);
+        Queue_Add(&gAppToRun, (QueueNode*)an);
     }
 }
 
-static void RunningToReady()
+static void AppMainToRun()
 {
-    if( Queue_Length(&gRunningTask) > 0 )
+    AppInfoToRun("AppMain", (void*)(*((uint*)AppMainEntry)), 200);
+}
+
+//应用堆开始时只有AppHeapInit字节, 其余页标记为不存在, 由SysSbrk按需映射
+static void AppHeapModInit()
+{
+    uint addr = 0;
+    
+    for(addr=gAppBrk; addr<KernelHeapBase; addr+=PAGE_SIZE)
     {
-        TaskNode* tn = (TaskNode*)Queue_Front(&gRunningTask);
+        *GetPageEntry(addr) &= ~PG_P;
         
-        if( !IsEqual(tn, (QueueNode*)gIdleTask) )
+        FlushPage(addr);
+    }
+}
+
+//应用堆增长incr字节(按页取整), 只保留地址范围, 页在第一次访问时由TaskDemandPage清零映射
+//返回原结束地址, 超出应用堆范围时返回0
+static void SysSbrk(uint incr, uint* ret)
+{
+    uint size = (incr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    if( TaskUserBuf(ret, sizeof(*ret), 1) )
+    {
+        *ret = 0;
+        
+        if( (size >= incr) && (size <= KernelHeapBase - gAppBrk) )
         {
-            if( tn->task.current == tn->task.total )
-            {
-                Queue_Remove(&gRunningTask);
-                Queue_Add(&gReadyTask, (QueueNode*)tn);
-            }
+            *ret = gAppBrk;
+            
+            gAppBrk += size;
         }
     }
 }
 
-static void RunningToWaitting(Queue* wq)
+//当前任务的私有区域增长incr字节(按页取整), 同样只保留地址范围; 返回原结束地址, 碰到栈区时返回0
+static void SysTaskSbrk(uint incr, uint* ret)
 {
-    if( Queue_Length(&gRunningTask) > 0 )
+    uint size = (incr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint brk = gCTaskAddr->brk;
+    
+    if( TaskUserBuf(ret, sizeof(*ret), 1) )
     {
-        TaskNode* tn = (TaskNode*)Queue_Front(&gRunningTask);
+        *ret = 0;
         
-        if( !IsEqual(tn, (QueueNode*)gIdleTask) )
+        if( (gCTaskAddr->cr3 != PageDirBase) && (size >= incr) && (size <= SPACE_STACK - brk) )
         {
-            Queue_Remove(&gRunningTask);
-            Queue_Add(wq, (QueueNode*)tn);
+            *ret = brk;
+            
+            gCTaskAddr->brk = brk + size;
         }
     }
 }
 
-
-static void WaittingToReady(Queue* wq)
+//addr位于task已保留的区域(应用堆, 私有区域的堆和栈): 页还未映射时映射一个清零的页, 是写时复制的页时
+//复制出task自己的页; 返回1表示做了处理, 页已可写. 应用堆在低4MB内, 恒等映射的物理页已存在, 只需置存在位
+static uint SpacePageIn(Task* task, uint addr)
 {
-    while( Queue_Length(wq) > 0 )
+    uint ret = 0;
+    uint page = addr - addr % PAGE_SIZE;
+    uint dir = task->cr3;
+    
+    if( (AppHeapBase <= addr) && (addr < gAppBrk) )
     {
-        TaskNode* tn = (TaskNode*)Queue_Front(wq);
-        //销毁任务,并且任务指针赋值为空
-        DestroyEvent(tn->task.event); 
-        tn->task.event = NULL;
+        uint* pte = GetPageEntry(page);
         
-        Queue_Remove(wq);
-        Queue_Add(&gReadyTask, (QueueNode*)tn);
+        if( !(*pte & PG_P) )
+        {
+            *pte |= PG_P | PG_RWW | PG_USU;
+            
+            FlushPage(page);
+            
+            MemSet((byte*)page, PAGE_SIZE, 0);
+            
+            ret = 1;
+        }
     }
+    else if( (dir != PageDirBase) && (((TaskSpaceBase <= addr) && (addr < task->brk)) || ((SPACE_STACK <= addr) && (addr < SPACE_END))) )
+    {
+        uint* pte = GetDirPageEntry(dir, page, 1);
+        
+        if( pte && (*pte & PG_COW) )
+        {
+            ret = CopyOnWrite(pte);
+        }
+        else if( pte && !(*pte & PG_P) )
+        {
+            void* frame = PageAlloc();
+            
+            if( frame )
+            {
+                MemSet((byte*)frame, PAGE_SIZE, 0);
+                
+                *pte = (uint)frame | PG_P | PG_RWW | PG_USU;
+                
+                ret = 1;
+            }
+        }
+        
+        if( ret && (dir == gCTaskAddr->cr3) )
+        {
+            FlushPage(page);
+        }
+    }
+    
+    return ret;
 }
 
-static void AppInfoToRun(const char* name, void(*tmain)(), byte pri)
+//内核代替task访问其地址空间中的addr, task可以不是当前任务: 返回内核可直接读写的地址, 失败返回NULL
+//低4MB的恒等映射和私有区域的物理页在所有页目录中都能被内核访问
+static void* SpaceAddr(Task* task, uint addr)
 {
-    AppNode* an = (AppNode*)Malloc(sizeof(AppNode));
+    void* ret = NULL;
+    uint* pte = GetDirPageEntry(task->cr3, addr, 0);
     
-    if( an )
+    if( (pte && ((*pte & (PG_P | PG_COW)) == PG_P)) || SpacePageIn(task, addr) )
     {
-        char* s = name ? (char*)Malloc(StrLen(name) + 1) : NULL;
+        pte = GetDirPageEntry(task->cr3, addr, 0);
         
-        an->app.name = s ? StrCpy(s, name, -1) : NULL;
-        an->app.tmain = tmain;
-        an->app.priority = pri;
-        
-        Queue_Add(&gAppToRun, (QueueNode*)an);
+        ret = (void*)(PageFrame(*pte) + addr % PAGE_SIZE);
     }
+    
+    return ret;
 }
 
-static void AppMainToRun()
+//缺页中断调用: 当前任务访问已保留但未映射的页或写时复制的页时返回1, 返回后重新执行引起缺页的指令
+uint TaskDemandPage(uint addr)
 {
-    AppInfoToRun("AppMain", (void*)(*((uint*)AppMainEntry)), 200);
+    return SpacePageIn((Task*)gCTaskAddr, addr);
+}
+
+//内核在系统调用中访问用户内存前调用: addr所在页已存在或可以装入时返回1, 写时复制的页同时被复制
+//内核态缺页无法恢复, 而CR0.WP未开启时内核写只读页不会缺页, 所以不能依赖缺页中断来处理这些页
+uint TaskPageIn(uint addr)
+{
+    return !!SpaceAddr((Task*)gCTaskAddr, addr);
+}
+
+//内核代替当前任务访问addr(例如硬盘DMA需要物理地址): 页已存在或可以装入时返回所在物理页中对应的地址, 否则返回NULL
+//物理页在内核中恒等映射, 返回的地址既可被内核访问也是物理地址
+void* TaskKernelAddr(uint addr)
+{
+    return SpaceAddr((Task*)gCTaskAddr, addr);
+}
+
+//addr所在页已存在且用户态可以访问时返回1, write不为0时还要求页可写
+static uint TaskUserPage(uint addr, uint write)
+{
+    return IsPageAllowed(gCTaskAddr->cr3, addr, PG_P | PG_USU | (write ? PG_RWW : 0));
+}
+
+//系统调用访问用户传入的指针前调用: 缓冲区必须位于应用区域或任务私有区域, 未装入的按需分配页和文件映射页先装入
+//内核态缺页无法恢复; CR0.WP未开启时内核写只读页不会出错, 所以write不为0(内核要写入缓冲区)时每一页还必须是用户可写的
+uint TaskUserBuf(const void* buf, uint len, uint write)
+{
+    uint begin = (uint)buf;
+    uint end = begin + len;
+    uint ret = buf && (begin <= end) && (((BaseOfApp <= begin) && (end <= KernelHeapBase)) || ((TaskSpaceBase <= begin) && (end <= SPACE_END)));
+    uint page = 0;
+    
+    for(page=begin-begin%PAGE_SIZE; ret && (page<end); page+=PAGE_SIZE)
+    {
+        ret = (TaskPageIn(page) || FMapFault(page)) && TaskUserPage(page, write);
+    }
+    
+    return ret;
+}
+
+//复制当前任务: 私有区域(堆和栈)写时复制, 应用区域仍为所有任务共享; 寄存器相同, 从同一个系统调用返回
+//父任务得到子任务id, 子任务得到0, 失败时为-1. 打开的文件, 互斥锁和arena中的对象不被继承
+static void SysFork(uint* ret)
+{
+    uint dir = 0;
+    uint valid = TaskUserBuf(ret, sizeof(*ret), 1);
+    
+    if( valid )
+    {
+        *ret = -1;
+    }
+    
+    if( valid && (gCTaskAddr->cr3 != PageDirBase) && Queue_Length(&gFreeTaskNode) && (dir = ForkPageDir(gCTaskAddr->cr3)) )
+    {
+        TaskNode* tn = (TaskNode*)Queue_Remove(&gFreeTaskNode);
+        Task* task = &tn->task;
+        byte* stack = task->stack;
+        uint* cret = NULL;
+        
+        SetPageDir(gCTaskAddr->cr3);    //父任务的页已改为只读, 刷新TLB
+        
+        *task = *(Task*)gCTaskAddr;
+        
+        task->stack = stack;
+        task->id = gPid++;
+        task->cr3 = dir;
+        task->current = 0;
+        task->event = NULL;
+        task->wevt.type = NoneEvent;
+        
+        ArenaInit(&task->arena);
+        Queue_Init(&task->wait);
+        
+        if( (cret = SpaceAddr(task, (uint)ret)) )
+        {
+            *cret = 0;
+        }
+        
+        RunArrayAdd(gActive, tn);
+        
+        TaskPageIn((uint)ret);
+        
+        *ret = task->id;
+    }
 }
 
 void TaskModInit()
@@ -247,6 +481,8 @@ void TaskModInit()
     int i = 0;
     byte* pStack = (byte*)(AppHeapBase - (AppStackSize * MAX_TASK_BUFF_NUM));
     
+    AppHeapModInit();
+    
     for(i=0; i<MAX_TASK_BUFF_NUM; i++)
     {
         TaskNode* tn = (void*)AddrOff(gTaskBuff, i);
@@ -258,8 +494,12 @@ void TaskModInit()
     
     Queue_Init(&gAppToRun);
     Queue_Init(&gFreeTaskNode);
-    Queue_Init(&gRunningTask);
-    Queue_Init(&gReadyTask);
+    
+    for(i=0; i<RUN_LEVEL_NUM; i++)
+    {
+        Queue_Init(&gRunArray[0].queue[i]);
+        Queue_Init(&gRunArray[1].queue[i]);
+    }
     
     for(i=0; i<MAX_TASK_NUM; i++)
     {
@@ -268,25 +508,17 @@ void TaskModInit()
     
     SetDescValue(AddrOff(gGdtInfo.entry, GDT_TASK_TSS_INDEX), (uint)&gTSS, sizeof(gTSS)-1, DA_386TSS + DA_DPL0);
     
-    InitTask(&gIdleTask->task, 0, "IdleTask", IdleTask, 255);
+    InitTask(&gIdleTask->task, 0, "IdleTask", IdleTask, 255, PageDirBase);
     
     AppMainToRun();
     
-    ReadyToRunning();
-    
-    CheckRunningTask();
+    CreateTask();
 }
 
 static void ScheduleNext()
 {
-    //若执行队列任务数未达到最大任务数，则从就绪队列中移入任务到执行队列
-    ReadyToRunning();
-    //判断是否有任务用于移动idle任务
-    CheckRunningTask();
-    //执行队列队首元素移动到队尾
-    Queue_Rotate(&gRunningTask);
-    //取出队首元素修改任务指针指向新任务
-    gCTaskAddr = &((TaskNode*)Queue_Front(&gRunningTask))->task;
+    //选出最高级别的任务修改任务指针指向新任务
+    PickNext();
     ////初始化好此任务的内核栈TSS信息和设置ldt信息
     PrepareForRun(gCTaskAddr);
     //加载队ldt信息到内存中
@@ -295,19 +527,49 @@ static void ScheduleNext()
 
 void LaunchTask()
 {
-    gCTaskAddr = &((TaskNode*)Queue_Front(&gRunningTask))->task;
+    PickNext();
     
     PrepareForRun(gCTaskAddr);
     
     RunTask(gCTaskAddr);
 }
 
+//当前任务的时间片用完时移入过期队列, 否则移到同级队列末尾, 同级任务轮流执行
 void Schedule()
 {
-    RunningToReady();
+    TaskNode* tn = RemoveCurrent();
+    
+    if( tn && (tn->task.current >= tn->task.total) )
+    {
+        tn->task.current = 0;
+        
+        RunArrayAdd(gExpired, tn);
+    }
+    else if( tn )
+    {
+        RunArrayAdd(gActive, tn);
+    }
+    
     ScheduleNext();
 }
 
+//当前任务用完时间片进入过期队列, 活动队列中的任务(包括级别更低的)都在它之前执行
+static void SysYield()
+{
+    gCTaskAddr->current = gCTaskAddr->total;
+    
+    Schedule();
+}
+
+//中断唤醒了级别更高的任务时立即调度, 不必等到下一次时钟调度
+void TaskPreempt()
+{
+    if( gActive->map && (IsIdle(gCTaskAddr) || (BitLow(gActive->map) < RunLevel(gCTaskAddr->pri))) )
+    {
+        Schedule();
+    }
+}
+
 static void WaitEvent(Queue* wait, Event* event)
 {
     //当前任务记录事件
@@ -347,6 +609,21 @@ static void MutexSchedule(uint action, Event* event)
     }
 }
 
+//event->id为文件描述符中等待队列的地址
+static void FileSchedule(uint action, Event* event)
+{
+    Queue* wait = (Queue*)event->id;
+    
+    if( action == NOTIFY )
+    {
+        WaittingToReady(wait);
+    }
+    else if( action == WAIT )
+    {
+        WaitEvent(wait, event);
+    }
+}
+
 //action == NOTIFY 任务从等待队列调度到就绪队列
 //action == WAIT   当前任务进入等待队列
 static void KeySchedule(uint action, Event* event)
@@ -362,9 +639,12 @@ static void KeySchedule(uint action, Event* event)
         {
             TaskNode* tn = (TaskNode*)pos;
             Event* we = tn->task.event;   //拿到任务的等待事件
-            uint* ret = (uint*)we->param1;//ReadKey函数中的ret
+            uint* ret = SpaceAddr(&tn->task, we->param1);//ReadKey函数中的ret, 在等待任务的地址空间中
             
-            *ret = kc;                  //用户的摁键编码返回给用户
+            if( ret )
+            {
+                *ret = kc;              //用户的摁键编码返回给用户
+            }
         }
         
         WaittingToReady(wait);
@@ -396,6 +676,9 @@ void EventSchedule(uint action, Event* event)
         case MutexEvent:
             MutexSchedule(action, event);
             break;
+        case FileEvent:
+            FileSchedule(action, event);
+            break;
         default:
             break;
     }
@@ -403,17 +686,26 @@ void EventSchedule(uint action, Event* event)
 
 void KillTask()
 {
-    QueueNode* node = Queue_Remove(&gRunningTask);
+    QueueNode* node = (QueueNode*)RemoveCurrent();
     Task* task = &((TaskNode*)node)->task;
     Event evt = {TaskEvent, (uint)task, 0, 0};
     //被本任务阻塞的其他任务都给唤醒
     EventSchedule(NOTIFY, &evt);
+    //关闭任务未关闭的文件, 销毁任务创建的互斥锁, 再整体释放任务的arena
+    FSTaskExit(task->id);
+    MutexTaskExit(task->id);
+    
+    ArenaRelease(&task->arena);
+    //先切换到全局页目录, 再释放任务的地址空间
+    SetPageDir(PageDirBase);
+    DestroyPageDir(task->cr3);
     
     task->id = 0;
+    task->cr3 = PageDirBase;
     
     Queue_Add(&gFreeTaskNode, node);
     
-    Schedule();
+    ScheduleNext();
 }
 
 void WaitTask(const char* name)
@@ -445,6 +737,18 @@ void TaskCallHandler(uint cmd, uint param1, uint param2)
         case 2:
             AppInfoToRun(((AppInfo*)param1)->name, ((AppInfo*)param1)->tmain, ((AppInfo*)param1)->priority);
             break;
+        case 3:
+            SysSbrk(param1, (uint*)param2);
+            break;
+        case 4:
+            SysTaskSbrk(param1, (uint*)param2);
+            break;
+        case 5:
+            SysFork((uint*)param1);
+            break;
+        case 6:
+            SysYield();
+            break;
         default:
             break;
     }
@@ -460,4 +764,14 @@ uint CurrentTaskId()
     return gCTaskAddr->id;
 }
 
+Arena* CurrentTaskArena()
+{
+    return gCTaskAddr ? (Arena*)&gCTaskAddr->arena : NULL;
+}
+
+Event* CurrentTaskEvent()
+{
+    return gCTaskAddr ? (Event*)&gCTaskAddr->wevt : NULL;
+}
+
 
@@ -6,6 +6,7 @@
 #include "queue.h"
 #include "event.h"
 #include "app.h"
+#include "memory.h"
 
 typedef struct 
 {
@@ -45,6 +46,8 @@ typedef struct
     Descriptor ldt[3];              //局部段描述符表,LDT描述局部于每个程序的段,包括代码段、数据段、显存段
     ushort     ldtSelector;         //LDT选择子
     ushort     tssSelector;         //TSS,用于查询内核栈
+    uint       cr3;                 //任务页目录的物理地址, LoadTask/RunTask据此切换地址空间(偏移100)
+    uint       brk;                 //任务私有区域的结束地址, 之后的页未映射
     void (*tmain)();                //任务起始地址
     uint       id;                  //任务id
     ushort     current;             //任务已经执行的时间
@@ -52,7 +55,10 @@ typedef struct
     char       name[16];            //任务名
     Queue      wait;                //被此任务的等待队列
     byte*      stack;               //任务栈
-    Event*     event;               //任务事件
+    Event*     event;               //任务事件, 等待时指向wevt, 否则为NULL
+    Arena      arena;               //代表任务在内核中申请的对象, 任务结束时整体释放
+    Event      wevt;                //任务同一时刻只等待一个事件, 直接存放在任务中
+    ushort     pri;                 //优先级, 数值越小越优先, 决定运行队列级别和时间片长度
 } Task;
 
 typedef struct
@@ -79,6 +85,7 @@ extern void (* const LoadTask)(volatile Task* pt);
 void TaskModInit();
 void LaunchTask();
 void Schedule();
+void TaskPreempt();
 void TaskCallHandler(uint cmd, uint param1, uint param2);
 void EventSchedule(uint action, Event* event);
 void KillTask();
@@ -86,5 +93,11 @@ void WaitTask(const char* name);
 
 const char* CurrentTaskName();
 uint CurrentTaskId();
+Arena* CurrentTaskArena();
+Event* CurrentTaskEvent();
+uint TaskDemandPage(uint addr);
+uint TaskPageIn(uint addr);
+uint TaskUserBuf(const void* buf, uint len, uint write);
+void* TaskKernelAddr(uint addr);
 
 #endif
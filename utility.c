@@ -133,5 +133,22 @@ int StrCmp(const char* left, const char* right, uint n)
     return ret;
 }
 
+//最低置位的位号, x不能为0
+uint BitLow(uint x)
+{
+    uint ret = 0;
+    
+    asm volatile("bsfl %1, %0" : "=r"(ret) : "rm"(x));
+    
+    return ret;
+}
 
-
+//最高置位的位号, x不能为0
+uint BitHigh(uint x)
+{
+    uint ret = 0;
+    
+    asm volatile("bsrl %1, %0" : "=r"(ret) : "rm"(x));
+    
+    return ret;
+}
@@ -0,0 +1,283 @@
+
+#include "virtblk.h"
+#include "const.h"
+#include "pci.h"
+#include "page.h"
+#include "utility.h"
+
+#define VB_PCI_ID          0x10011AF4  //厂商0x1AF4, 设备0x1001: 传统(legacy)接口的virtio-blk
+
+#define VIO_GUEST_FEATURES 0x04
+#define VIO_QUEUE_PFN      0x08
+#define VIO_QUEUE_SIZE     0x0C
+#define VIO_QUEUE_SELECT   0x0E
+#define VIO_QUEUE_NOTIFY   0x10
+#define VIO_STATUS         0x12
+#define VIO_ISR            0x13
+#define VIO_BLK_CAPACITY   0x14        //未启用MSI-X时设备配置从0x14开始
+
+#define VIO_STATUS_ACK       0x01
+#define VIO_STATUS_DRIVER    0x02
+#define VIO_STATUS_DRIVER_OK 0x04
+#define VIO_STATUS_FAILED    0x80
+
+#define VRING_DESC_F_NEXT          1
+#define VRING_DESC_F_WRITE         2
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+
+#define VB_MAX_SEGS        16                  //一条命令最多包含的请求数
+#define VB_DESC_PER_CMD    (VB_MAX_SEGS + 2)   //命令头 + 数据 + 状态字节
+#define VB_POLL_LIMIT      0x40000000          //等待命令完成的最大轮询次数
+
+extern byte ReadPort(ushort port);
+extern void WritePort(ushort port, byte value);
+extern void ReadPortW(ushort port, ushort* buf, uint n);
+extern void WritePortW(ushort port, ushort* buf, uint n);
+extern uint ReadPortL(ushort port);
+extern void WritePortL(ushort port, uint value);
+
+typedef struct
+{
+    uint addr;              //物理地址低32位
+    uint addrHi;
+    uint len;
+    ushort flags;
+    ushort next;
+} VRingDesc;
+
+typedef struct
+{
+    ushort flags;
+    ushort idx;
+    ushort ring[];
+} VRingAvail;
+
+typedef struct
+{
+    uint id;                //描述符链的第一个描述符
+    uint len;
+} VRingUsedElem;
+
+typedef struct
+{
+    ushort flags;
+    ushort idx;
+    VRingUsedElem ring[];
+} VRingUsed;
+
+typedef struct
+{
+    uint type;
+    uint reserved;
+    uint sector;            //起始扇区低32位
+    uint sectorHi;
+} VBlkHeader;
+
+static uint gVBPort = 0;
+static uint gVBQSize = 0;
+static uint gVBSectors = -1;
+static uint gVBNotify = 0;              //有尚未通知设备的命令
+static ushort gVBUsedIdx = 0;           //已处理到的used ring位置
+static volatile VRingDesc* gVBDesc = NULL;
+static volatile VRingAvail* gVBAvail = NULL;
+static volatile VRingUsed* gVBUsed = NULL;
+static VBlkHeader gVBHeader[HD_MAX_SLOTS] = {0};
+static volatile byte gVBStatus[HD_MAX_SLOTS] = {0};
+static HDCommand* gVBCmd[HD_MAX_SLOTS] = {0};
+
+static uint VBSectors()
+{
+    return gVBSectors;
+}
+
+static uint VBMaxSectors()
+{
+    return 0xFFFF;
+}
+
+static void SetDesc(uint i, const volatile void* addr, uint len, uint flags)
+{
+    volatile VRingDesc* desc = AddrOff(gVBDesc, i);
+    
+    desc->addr = (uint)addr;            //线性地址与物理地址一一对应
+    desc->addrHi = 0;
+    desc->len = len;
+    desc->flags = flags;
+    desc->next = i + 1;
+}
+
+//每个槽位固定使用VB_DESC_PER_CMD个描述符, 多个请求的缓冲区作为同一条描述符链的数据段
+//命令放入avail ring后暂不通知设备, 在VBPoll中一次通知, 使一批命令只产生一次端口写
+static void VBIssue(HDCommand* cmd)
+{
+    uint head = cmd->tag * VB_DESC_PER_CMD;
+    uint i = head;
+    VBlkHeader* hdr = gVBHeader + cmd->tag;
+    ListNode* pos = NULL;
+    
+    hdr->type = cmd->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    hdr->reserved = 0;
+    hdr->sector = cmd->si;
+    hdr->sectorHi = 0;
+    
+    gVBStatus[cmd->tag] = 0xFF;
+    gVBCmd[cmd->tag] = cmd;
+    
+    SetDesc(i++, hdr, sizeof(*hdr), VRING_DESC_F_NEXT);
+    
+    List_ForEach(&cmd->reqs, pos)
+    {
+        HDRequest* req = (HDRequest*)pos;
+        
+        SetDesc(i++, req->buf, req->cnt * SECT_SIZE, VRING_DESC_F_NEXT | (cmd->write ? 0 : VRING_DESC_F_WRITE));
+    }
+    
+    SetDesc(i, gVBStatus + cmd->tag, 1, VRING_DESC_F_WRITE);
+    
+    gVBAvail->ring[gVBAvail->idx % gVBQSize] = head;
+    
+    asm volatile("" : : : "memory");    //描述符写完后才能更新idx
+    
+    gVBAvail->idx++;
+    gVBNotify = 1;
+}
+
+static void Complete(uint tag, uint ok)
+{
+    HDCommand* cmd = gVBCmd[tag];
+    
+    if( cmd )
+    {
+        gVBCmd[tag] = NULL;
+        
+        HDRawComplete(cmd, ok);
+    }
+}
+
+//内核态关中断运行, 所以关闭设备中断并轮询used ring
+static void VBPoll()
+{
+    uint i = 0;
+    
+    if( gVBNotify )
+    {
+        ushort queue = 0;
+        
+        gVBNotify = 0;
+        
+        WritePortW(gVBPort + VIO_QUEUE_NOTIFY, &queue, 1);
+    }
+    
+    while( (gVBUsed->idx == gVBUsedIdx) && (i < VB_POLL_LIMIT) )
+    {
+        i++;
+    }
+    
+    ReadPort(gVBPort + VIO_ISR);
+    
+    if( gVBUsed->idx != gVBUsedIdx )
+    {
+        while( gVBUsed->idx != gVBUsedIdx )
+        {
+            uint tag = gVBUsed->ring[gVBUsedIdx % gVBQSize].id / VB_DESC_PER_CMD;
+            
+            gVBUsedIdx++;
+            
+            Complete(tag, gVBStatus[tag] == 0);
+        }
+    }
+    else
+    {   //设备没有响应, 放弃全部正在执行的命令
+        for(i=0; i<HD_MAX_SLOTS; i++)
+        {
+            Complete(i, 0);
+        }
+        
+        WritePort(gVBPort + VIO_STATUS, VIO_STATUS_FAILED);
+    }
+}
+
+static HDDevice gVBDevice = { "virtio", 0, VB_MAX_SEGS, VBSectors, VBMaxSectors, VBIssue, VBPoll };
+
+static uint AlignPage(uint size)
+{
+    return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+//传统virtio的队列布局: 描述符表与avail ring连续存放, used ring从下一个页边界开始
+static uint SetupQueue()
+{
+    uint ret = 0;
+    ushort queue = 0;
+    ushort size = 0;
+    
+    WritePortW(gVBPort + VIO_QUEUE_SELECT, &queue, 1);
+    ReadPortW(gVBPort + VIO_QUEUE_SIZE, &size, 1);
+    
+    if( size >= VB_DESC_PER_CMD )
+    {
+        uint used = AlignPage(sizeof(VRingDesc) * size + sizeof(VRingAvail) + sizeof(ushort) * (size + 1));
+        uint total = used + AlignPage(sizeof(VRingUsed) + sizeof(VRingUsedElem) * size + sizeof(ushort));
+        byte* ring = PageAllocN(total / PAGE_SIZE);
+        
+        if( ret = !!ring )
+        {
+            MemSet(ring, total, 0);
+            
+            gVBQSize = size;
+            gVBDesc = (VRingDesc*)ring;
+            gVBAvail = (VRingAvail*)AddrOff(ring, sizeof(VRingDesc) * size);
+            gVBUsed = (VRingUsed*)AddrOff(ring, used);
+            gVBUsedIdx = 0;
+            
+            gVBAvail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+            
+            WritePortL(gVBPort + VIO_QUEUE_PFN, (uint)ring / PAGE_SIZE);
+            
+            gVBDevice.slots = Min(HD_MAX_SLOTS, size / VB_DESC_PER_CMD);
+        }
+    }
+    
+    return ret;
+}
+
+//查找PCI总线上的virtio-blk设备, 不需要任何可选特性
+const HDDevice* VirtBlkModInit()
+{
+    const HDDevice* ret = NULL;
+    uint dev = PciFind(PCI_ID, 0xFFFFFFFF, VB_PCI_ID, 0);
+    uint bar = (dev != PCI_NONE) ? PciRead(dev, PCI_BAR0) : 0;
+    
+    if( !gVBPort && (bar & 1) )   //BAR0为I/O空间
+    {
+        gVBPort = bar & 0xFFFC;
+        
+        PciEnable(dev, PCI_CMD_IO | PCI_CMD_MASTER);
+        
+        WritePort(gVBPort + VIO_STATUS, 0);     //复位
+        WritePort(gVBPort + VIO_STATUS, VIO_STATUS_ACK);
+        WritePort(gVBPort + VIO_STATUS, VIO_STATUS_ACK | VIO_STATUS_DRIVER);
+        WritePortL(gVBPort + VIO_GUEST_FEATURES, 0);
+        
+        if( SetupQueue() )
+        {
+            uint low = ReadPortL(gVBPort + VIO_BLK_CAPACITY);
+            uint high = ReadPortL(gVBPort + VIO_BLK_CAPACITY + 4);
+            
+            gVBSectors = high ? HD_MAX_SCT_NUM : Min(low, HD_MAX_SCT_NUM);
+            
+            WritePort(gVBPort + VIO_STATUS, VIO_STATUS_ACK | VIO_STATUS_DRIVER | VIO_STATUS_DRIVER_OK);
+            
+            ret = &gVBDevice;
+        }
+        else
+        {
+            WritePort(gVBPort + VIO_STATUS, VIO_STATUS_FAILED);
+        }
+    }
+    
+    return ret;
+}
@@ -0,0 +1,9 @@
+
+#ifndef VIRTBLK_H
+#define VIRTBLK_H
+
+#include "hdraw.h"
+
+const HDDevice* VirtBlkModInit();
+
+#endif